@@ -0,0 +1,260 @@
+// aio.c ... asynchronous page reads
+// part of Multi-attribute Linear-hashed Files
+// Lets the buffer pool start reading pages before they are needed,
+// with up to MAXREADS reads in progress at once
+// Reads go through io_uring where the kernel provides it; otherwise
+// (or if setting up a ring fails) through a small pool of threads
+// doing pread()
+
+#define _GNU_SOURCE     // for syscall()
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#endif
+#include "defs.h"
+#include "aio.h"
+
+#define MAXREADS  64    // max #reads in progress
+#define NWORKERS  4     // #threads when there's no io_uring
+
+// A Read describes one request
+// - state is FREE, QUEUED (waiting for a worker thread),
+//   BUSY (submitted/being read) or DONE
+// - result is the return value of the read (or -errno)
+
+#define FREE   0
+#define QUEUED 1
+#define BUSY   2
+#define DONE   3
+
+typedef struct {
+	int      state;   // progress of request
+	PageFile file;    // file being read
+	PageID   pid;     // page being read
+	Byte    *buf;     // where the page goes
+	ssize_t  result;  // #bytes read, or -errno
+} Read;
+
+static struct {
+	Bool     started; // engine set up?
+	Bool     uring;   // using io_uring (rather than threads)?
+	Read     reads[MAXREADS];
+	// thread pool
+	pthread_mutex_t lock;
+	pthread_cond_t  queued;  // signalled when a request is QUEUED
+	pthread_cond_t  done;    // signalled when a request is DONE
+} aio = {
+	.lock = PTHREAD_MUTEX_INITIALIZER,
+	.queued = PTHREAD_COND_INITIALIZER,
+	.done = PTHREAD_COND_INITIALIZER,
+};
+
+#ifdef __NR_io_uring_setup
+
+// io_uring, set up by hand rather than via liburing
+// the kernel shares a submission ring (indexes into sqes[])
+//  and a completion ring with us through mmap()
+
+static struct {
+	int       fd;
+	unsigned *sqhead, *sqtail, *sqmask, *sqarray;
+	unsigned *cqhead, *cqtail, *cqmask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+} ring;
+
+static Bool startUring(void)
+{
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	int fd = syscall(__NR_io_uring_setup, MAXREADS, &p);
+	if (fd < 0) return FALSE;
+	size_t sqlen = p.sq_off.array + p.sq_entries*sizeof(unsigned);
+	size_t cqlen = p.cq_off.cqes + p.cq_entries*sizeof(struct io_uring_cqe);
+	size_t sqelen = p.sq_entries*sizeof(struct io_uring_sqe);
+	Byte *sq = mmap(NULL, sqlen, PROT_READ|PROT_WRITE, MAP_SHARED,
+	                fd, IORING_OFF_SQ_RING);
+	Byte *cq = mmap(NULL, cqlen, PROT_READ|PROT_WRITE, MAP_SHARED,
+	                fd, IORING_OFF_CQ_RING);
+	void *sqes = mmap(NULL, sqelen, PROT_READ|PROT_WRITE, MAP_SHARED,
+	                  fd, IORING_OFF_SQES);
+	if (sq == MAP_FAILED || cq == MAP_FAILED || sqes == MAP_FAILED) {
+		close(fd);
+		return FALSE;
+	}
+	ring.fd = fd;
+	ring.sqhead = (unsigned *)(sq + p.sq_off.head);
+	ring.sqtail = (unsigned *)(sq + p.sq_off.tail);
+	ring.sqmask = (unsigned *)(sq + p.sq_off.ring_mask);
+	ring.sqarray = (unsigned *)(sq + p.sq_off.array);
+	ring.cqhead = (unsigned *)(cq + p.cq_off.head);
+	ring.cqtail = (unsigned *)(cq + p.cq_off.tail);
+	ring.cqmask = (unsigned *)(cq + p.cq_off.ring_mask);
+	ring.cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	ring.sqes = sqes;
+	return TRUE;
+}
+
+// put a read on the submission ring and tell the kernel
+// there are never more than MAXREADS requests around, so
+//  the ring can't be full
+
+static void submitUring(IOTicket t)
+{
+	Read *rd = &aio.reads[t];
+	unsigned tail = *ring.sqtail;
+	unsigned i = tail & *ring.sqmask;
+	struct io_uring_sqe *sqe = &ring.sqes[i];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = IORING_OP_READ;
+	sqe->fd = fileDescriptor(rd->file);
+	sqe->addr = (unsigned long)rd->buf;
+	sqe->len = filePageSize(rd->file);
+	sqe->off = (unsigned long long)rd->pid*filePageSize(rd->file);
+	sqe->user_data = t;
+	ring.sqarray[i] = i;
+	__atomic_store_n(ring.sqtail, tail+1, __ATOMIC_RELEASE);
+	long n;
+	while ((n = syscall(__NR_io_uring_enter, ring.fd, 1, 0, 0, NULL, 0)) < 0
+	       && (errno == EINTR || errno == EAGAIN || errno == EBUSY))
+		/* try again */;
+	if (n != 1) fatal("Can't submit read to io_uring");
+}
+
+// collect completed reads; if wait, block until there's one
+
+static void reapUring(Bool wait)
+{
+	if (wait)
+		syscall(__NR_io_uring_enter, ring.fd, 0, 1,
+		        IORING_ENTER_GETEVENTS, NULL, 0);
+	unsigned head = *ring.cqhead;
+	while (head != __atomic_load_n(ring.cqtail, __ATOMIC_ACQUIRE)) {
+		struct io_uring_cqe *cqe = &ring.cqes[head & *ring.cqmask];
+		aio.reads[cqe->user_data].result = cqe->res;
+		aio.reads[cqe->user_data].state = DONE;
+		head++;
+	}
+	__atomic_store_n(ring.cqhead, head, __ATOMIC_RELEASE);
+}
+
+#else
+
+static Bool startUring(void) { return FALSE; }
+static void submitUring(IOTicket t) { }
+static void reapUring(Bool wait) { }
+
+#endif
+
+// thread pool: each worker takes the next QUEUED request
+
+static void *worker(void *arg)
+{
+	pthread_mutex_lock(&aio.lock);
+	for (;;) {
+		int t;
+		for (t = 0; t < MAXREADS; t++)
+			if (aio.reads[t].state == QUEUED) break;
+		if (t == MAXREADS) {
+			pthread_cond_wait(&aio.queued, &aio.lock);
+			continue;
+		}
+		Read *rd = &aio.reads[t];
+		rd->state = BUSY;
+		pthread_mutex_unlock(&aio.lock);
+		ssize_t n = pread(fileDescriptor(rd->file), rd->buf,
+		                  filePageSize(rd->file),
+		                  (off_t)rd->pid*filePageSize(rd->file));
+		pthread_mutex_lock(&aio.lock);
+		rd->result = (n < 0) ? -errno : n;
+		rd->state = DONE;
+		pthread_cond_broadcast(&aio.done);
+	}
+	return NULL;
+}
+
+static void startEngine(void)
+{
+	aio.started = TRUE;
+	aio.uring = startUring();
+	if (aio.uring) return;
+	for (int i = 0; i < NWORKERS; i++) {
+		pthread_t tid;
+		if (pthread_create(&tid, NULL, worker, NULL) != 0)
+			fatal("Can't start I/O threads");
+		pthread_detach(tid);
+	}
+}
+
+// start reading page pid of file f into buf
+// returns NO_TICKET if MAXREADS reads are already in progress
+// buf must not be touched until finishRead() is called
+
+IOTicket startRead(PageFile f, PageID pid, Byte *buf)
+{
+	if (!aio.started) startEngine();
+	pthread_mutex_lock(&aio.lock);
+	IOTicket t;
+	for (t = 0; t < MAXREADS; t++)
+		if (aio.reads[t].state == FREE) break;
+	if (t == MAXREADS) {
+		pthread_mutex_unlock(&aio.lock);
+		return NO_TICKET;
+	}
+	Read *rd = &aio.reads[t];
+	rd->file = f;
+	rd->pid = pid;
+	rd->buf = buf;
+	rd->state = aio.uring ? BUSY : QUEUED;
+	pthread_mutex_unlock(&aio.lock);
+	if (aio.uring)
+		submitUring(t);
+	else
+		pthread_cond_signal(&aio.queued);
+	return t;
+}
+
+// has a read finished?
+
+Bool readDone(IOTicket t)
+{
+	assert(t >= 0 && t < MAXREADS);
+	if (aio.uring) {
+		reapUring(FALSE);
+		return aio.reads[t].state == DONE;
+	}
+	pthread_mutex_lock(&aio.lock);
+	Bool done = (aio.reads[t].state == DONE);
+	pthread_mutex_unlock(&aio.lock);
+	return done;
+}
+
+// wait for a read to finish and release its ticket
+// a read which failed or came up short (e.g. O_DIRECT alignment
+//  rules not met) is redone synchronously, which either
+//  succeeds or reports the error
+
+void finishRead(IOTicket t)
+{
+	assert(t >= 0 && t < MAXREADS);
+	Read *rd = &aio.reads[t];
+	if (aio.uring) {
+		while (rd->state != DONE) reapUring(TRUE);
+	}
+	else {
+		pthread_mutex_lock(&aio.lock);
+		while (rd->state != DONE)
+			pthread_cond_wait(&aio.done, &aio.lock);
+		pthread_mutex_unlock(&aio.lock);
+	}
+	if (rd->result != filePageSize(rd->file))
+		readBlock(rd->file, rd->pid, rd->buf);
+	pthread_mutex_lock(&aio.lock);
+	rd->state = FREE;
+	pthread_mutex_unlock(&aio.lock);
+}
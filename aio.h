@@ -0,0 +1,19 @@
+// aio.h ... interface to asynchronous page reads
+// part of Multi-attribute Linear-hashed Files
+// See aio.c for details of the I/O engine and functions
+
+#ifndef AIO_H
+#define AIO_H 1
+
+#include "defs.h"
+#include "pagefile.h"
+
+typedef int IOTicket;   // identifies a read in progress
+
+#define NO_TICKET (-1)
+
+IOTicket startRead(PageFile f, PageID pid, Byte *buf);
+Bool readDone(IOTicket t);
+void finishRead(IOTicket t);
+
+#endif
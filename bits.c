@@ -38,8 +38,7 @@ Bits unsetBit(Bits val, int position)
 Bits getLower(Bits b, int n)
 {
 	assert(1 <= n && n <= 32);
-	int i; Bits mask = 0;
-	for (i = 0; i < n; i++) mask |= (1<<i);
+	Bits mask = (n == 32) ? ~(Bits)0 : ((Bits)1 << n) - 1;
 	return b&mask;
 }
 
@@ -0,0 +1,262 @@
+// buffer.c ... shared buffer pool for Pages
+// part of Multi-attribute Linear-hashed Files
+// Caches pages from .data and .ovflow files in a fixed set of
+// frames, so that repeated getPage()/putPage() calls on the same
+// page do not each turn into a pread()/pwrite()
+
+#include <stdint.h>
+#include "defs.h"
+#include "buffer.h"
+#include "aio.h"
+
+// A frame holds one page from some file
+// - file,pid identify the page (file == NULL if frame is unused)
+// - pins counts users currently holding a pointer to the buffer
+// - dirty pages are written back on eviction or flushBuffers()
+// - ref is the "recently used" bit for the clock sweep
+// - next links frames in the same hash table slot
+// - io identifies a prefetch read still filling the frame; the
+//   frame holds a pin of its own until the read is finished
+
+typedef struct {
+	PageFile file;  // file containing the page
+	PageID  pid;    // page id within file
+	Count   pins;   // #users holding the page
+	Bool    dirty;  // modified since read?
+	Bool    ref;    // used since last clock sweep?
+	int     next;   // next frame in hash chain (-1 = none)
+	IOTicket io;    // read in progress (NO_TICKET = none)
+} Frame;
+
+static struct {
+	Count  nframes; // #frames in pool
+	Count  hand;    // clock hand for replacement
+	Count  fsize;   // #bytes in each frame (largest page size seen)
+	Frame *frames;  // frame descriptors
+	Byte  *bufs;    // nframes*fsize bytes of page buffers
+	int   *table;   // hash table mapping (file,pid) -> frame
+	Count  tsize;   // #slots in hash table (power of 2)
+	Count  loading; // #frames with prefetch reads in progress
+} pool;
+
+// set up a pool with nframes frames (e.g. from a tool's -B option)
+// must be called before the pool is first used; if it isn't
+//  called, first use sets up NBUFFERS frames
+
+void initBufferPool(Count nframes)
+{
+	assert(pool.frames == NULL);
+	assert(nframes > 0);
+	pool.nframes = nframes;
+	pool.hand = 0;
+	pool.loading = 0;
+	pool.fsize = PAGESIZE;
+	pool.frames = malloc(nframes*sizeof(Frame));
+	assert(pool.frames != NULL);
+	pool.bufs = allocBlock((size_t)nframes*pool.fsize);
+	for (pool.tsize = 1; pool.tsize < 2*nframes; pool.tsize <<= 1) /**/;
+	pool.table = malloc(pool.tsize*sizeof(int));
+	assert(pool.table != NULL);
+	for (Count i = 0; i < pool.tsize; i++) pool.table[i] = -1;
+	for (Count i = 0; i < nframes; i++) {
+		pool.frames[i].file = NULL;
+		pool.frames[i].pins = 0;
+		pool.frames[i].dirty = FALSE;
+		pool.frames[i].ref = FALSE;
+		pool.frames[i].next = -1;
+		pool.frames[i].io = NO_TICKET;
+	}
+}
+
+static Byte *frameBuf(int i) { return pool.bufs + (size_t)i*pool.fsize; }
+
+static Count slotOf(PageFile f, PageID pid)
+{
+	uintptr_t h = (uintptr_t)f;
+	h = (h >> 4) * 0x9e3779b1u + pid;
+	h ^= h >> 15;
+	return h & (pool.tsize-1);
+}
+
+static int lookup(PageFile f, PageID pid)
+{
+	int i = pool.table[slotOf(f,pid)];
+	while (i >= 0 && (pool.frames[i].file != f || pool.frames[i].pid != pid))
+		i = pool.frames[i].next;
+	return i;
+}
+
+static void unlinkFrame(int i)
+{
+	int *ip = &pool.table[slotOf(pool.frames[i].file, pool.frames[i].pid)];
+	while (*ip != i) ip = &pool.frames[*ip].next;
+	*ip = pool.frames[i].next;
+	pool.frames[i].file = NULL;
+	pool.frames[i].next = -1;
+}
+
+static void linkFrame(int i, PageFile f, PageID pid)
+{
+	Count s = slotOf(f,pid);
+	pool.frames[i].file = f;
+	pool.frames[i].pid = pid;
+	pool.frames[i].next = pool.table[s];
+	pool.table[s] = i;
+}
+
+// write a dirty frame back to its file
+
+static void writeFrame(int i)
+{
+	Frame *fr = &pool.frames[i];
+	writeBlock(fr->file, fr->pid, frameBuf(i));
+	fr->dirty = FALSE;
+}
+
+// complete the prefetch read into frame i, and drop its pin
+
+static void finishLoad(int i)
+{
+	finishRead(pool.frames[i].io);
+	pool.frames[i].io = NO_TICKET;
+	pool.frames[i].pins--;
+	pool.loading--;
+}
+
+// finish any prefetch reads which are already complete, making
+//  their frames ordinary (unpinned) pages in the pool
+
+static void reapLoads()
+{
+	for (Count i = 0; i < pool.nframes; i++) {
+		if (pool.frames[i].io != NO_TICKET && readDone(pool.frames[i].io))
+			finishLoad(i);
+	}
+}
+
+// choose a frame to (re)use via the clock algorithm
+// unpinned frames with the ref bit set get a second chance
+
+static int victim()
+{
+	for (Count n = 0; n < 2*pool.nframes; n++) {
+		int i = pool.hand;
+		Frame *fr = &pool.frames[i];
+		pool.hand = (pool.hand+1) % pool.nframes;
+		if (fr->pins > 0) continue;
+		if (fr->ref) { fr->ref = FALSE; continue; }
+		if (fr->file != NULL) {
+			if (fr->dirty) writeFrame(i);
+			unlinkFrame(i);
+		}
+		return i;
+	}
+	fatal("Buffer pool exhausted: all frames pinned");
+	return -1;
+}
+
+// make every frame big enough for pages of size bytes
+// only possible while no pages are pinned, which in practice
+//  means when the first relation with larger pages is opened
+
+static void growFrames(Count size)
+{
+	for (Count i = 0; i < pool.nframes; i++) {
+		Frame *fr = &pool.frames[i];
+		if (fr->io != NO_TICKET) finishLoad(i);
+		if (fr->pins > 0) fatal("Can't enlarge buffer pool frames while pages are pinned");
+		if (fr->file == NULL) continue;
+		if (fr->dirty) writeFrame(i);
+		unlinkFrame(i);
+	}
+	free(pool.bufs);
+	pool.fsize = size;
+	pool.bufs = allocBlock((size_t)pool.nframes*pool.fsize);
+}
+
+// pin a page in the pool; return pointer to its buffer
+// if load is false, the caller is about to overwrite the
+//  whole page, so a page not in the pool is not read in
+
+Byte *pinPage(PageFile f, PageID pid, Bool load)
+{
+	if (pool.frames == NULL) initBufferPool(NBUFFERS);
+	if (filePageSize(f) > pool.fsize) growFrames(filePageSize(f));
+	int i = lookup(f, pid);
+	if (i >= 0 && pool.frames[i].io != NO_TICKET) {
+		// prefetched; wait for the read to finish
+		finishLoad(i);
+	}
+	if (i < 0) {
+		i = victim();
+		if (load) readBlock(f, pid, frameBuf(i));
+		linkFrame(i, f, pid);
+		pool.frames[i].dirty = FALSE;
+	}
+	pool.frames[i].pins++;
+	pool.frames[i].ref = TRUE;
+	return frameBuf(i);
+}
+
+// start reading a page into the pool in the background, so that
+//  a later pinPage() finds it there (or on its way)
+// does nothing if the page is already in the pool, or if too
+//  many reads are already in progress (including reads holding
+//  half of the pool's frames, so that a small pool always has
+//  frames for pinPage())
+
+void prefetchBuffer(PageFile f, PageID pid)
+{
+	if (pool.frames == NULL) initBufferPool(NBUFFERS);
+	if (filePageSize(f) > pool.fsize) growFrames(filePageSize(f));
+	if (lookup(f, pid) >= 0) return;
+	if (pool.loading >= pool.nframes/2) reapLoads();
+	if (pool.loading >= pool.nframes/2) return;
+	int i = victim();
+	IOTicket t = startRead(f, pid, frameBuf(i));
+	if (t == NO_TICKET) {
+		reapLoads();
+		t = startRead(f, pid, frameBuf(i));
+		if (t == NO_TICKET) return;
+	}
+	linkFrame(i, f, pid);
+	pool.frames[i].dirty = FALSE;
+	pool.frames[i].io = t;
+	pool.frames[i].pins = 1;
+	pool.loading++;
+	pool.frames[i].ref = TRUE;
+}
+
+// release one pin on a buffer; note if it was modified
+
+void unpinPage(Byte *buf, Bool dirty)
+{
+	assert(isBuffered(buf));
+	int i = (buf - pool.bufs) / pool.fsize;
+	assert(pool.frames[i].pins > 0);
+	pool.frames[i].pins--;
+	if (dirty) pool.frames[i].dirty = TRUE;
+}
+
+// is this a pointer to a buffer in the pool?
+
+Bool isBuffered(Byte *buf)
+{
+	uintptr_t b = (uintptr_t)buf, lo = (uintptr_t)pool.bufs;
+	return (pool.bufs != NULL && b >= lo
+	        && b < lo + (uintptr_t)pool.nframes*pool.fsize);
+}
+
+// write back all dirty pages for a file and drop them from
+// the pool; must be done before the file is closed
+
+void flushBuffers(PageFile f)
+{
+	for (Count i = 0; i < pool.nframes; i++) {
+		if (pool.frames[i].file != f) continue;
+		if (pool.frames[i].io != NO_TICKET) finishLoad(i);
+		assert(pool.frames[i].pins == 0);
+		if (pool.frames[i].dirty) writeFrame(i);
+		unlinkFrame(i);
+	}
+}
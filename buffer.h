@@ -0,0 +1,18 @@
+// buffer.h ... interface to the shared buffer pool
+// part of Multi-attribute Linear-hashed Files
+// See buffer.c for details of the buffer pool and functions
+
+#ifndef BUFFER_H
+#define BUFFER_H 1
+
+#include "defs.h"
+#include "pagefile.h"
+
+void initBufferPool(Count nframes);
+Byte *pinPage(PageFile f, PageID pid, Bool load);
+void prefetchBuffer(PageFile f, PageID pid);
+void unpinPage(Byte *buf, Bool dirty);
+Bool isBuffered(Byte *buf);
+void flushBuffers(PageFile f);
+
+#endif
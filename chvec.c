@@ -5,6 +5,10 @@
 // See chvec.c for details on functions
 // Last modified by John Shepherd, July 2019
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_BMI2 1     // can build pext/pdep code (if the CPU has it)
+#endif
 #include "defs.h"
 #include "reln.h"
 #include "chvec.h"
@@ -69,3 +73,159 @@ void printChVec(ChVec cv)
 	}
 	printf("\n");
 }
+
+// A ChVecPlan is a choice vector compiled, when a relation is
+// opened, into a form that builds the multi-attribute hash from
+// the attributes' hashes a whole attribute at a time, rather than
+// a bit at a time. For each attribute:
+// - mask has bit i set if cv[i] is one of the attribute's bits
+// - table[j][v] is the part of the MAH given by byte j of the
+//   attribute's hash having value v (four lookups per attribute)
+// - on CPUs with BMI2, the attribute's bits are split into runs
+//   which appear in the same order, or in reverse order, in the
+//   hash and in the MAH; pext gathers each run from the hash (or,
+//   for a reversed run, from the hash with its bits reversed), and
+//   pdep scatters it to its MAH positions (two instructions per run)
+// The bits taken from the top of each hash by parseChVec() form a
+// reversed run, so a vector filled in by parseChVec() needs one
+// run more than the bits given explicitly. Attributes needing more
+// than MAXRUNS runs use the tables.
+
+#define MAXRUNS 4
+
+typedef struct {
+	Bits  mask;           // MAH bits taken from this attribute
+	Count nruns;          // #runs (0 = use table)
+	Bool  anyrev;         // are any runs reversed?
+	Bool  rev[MAXRUNS];   // is each run reversed?
+	Bits  src[MAXRUNS];   // bits of the hash in each run (of the
+	                      //  reversed hash, for reversed runs)
+	Bits  dst[MAXRUNS];   // their positions in the MAH
+	Bits  table[4][256];  // MAH bits from each byte of the hash
+} AttrPlan;
+
+struct ChVecPlanRep {
+	Count    nattrs;
+	Bool     bmi2;        // does the CPU have pext/pdep?
+	AttrPlan attrs[1];    // one per attribute
+};
+
+// x with its 32 bits in reverse order
+
+static Bits reverseBits(Bits x)
+{
+	x = ((x >> 1) & 0x55555555) | ((x & 0x55555555) << 1);
+	x = ((x >> 2) & 0x33333333) | ((x & 0x33333333) << 2);
+	x = ((x >> 4) & 0x0f0f0f0f) | ((x & 0x0f0f0f0f) << 4);
+	x = ((x >> 8) & 0x00ff00ff) | ((x & 0x00ff00ff) << 8);
+	return (x >> 16) | (x << 16);
+}
+
+// split attribute a's bits into as few runs as possible
+// bits are taken in MAH order, each joining the first run whose
+//  hash bits it continues: upward for an increasing run, downward
+//  for a decreasing (reversed) one, either way for a run of one
+//  bit; a run can't use the same hash bit twice
+
+static void planRuns(ChVec cv, Count a, AttrPlan *ap)
+{
+	Count last[MAXRUNS];
+	int dir[MAXRUNS];     // +1 increasing, -1 decreasing, 0 not yet known
+	ap->nruns = 0;
+	for (Count i = 0; i < MAXCHVEC; i++) {
+		if (cv[i].att != a) continue;
+		Count b = cv[i].bit, r;
+		for (r = 0; r < ap->nruns; r++) {
+			if (dir[r] >= 0 && last[r] < b) { dir[r] = 1; break; }
+			if (dir[r] <= 0 && last[r] > b) { dir[r] = -1; break; }
+		}
+		if (r == ap->nruns) {
+			if (r == MAXRUNS) {
+				ap->nruns = 0;
+				return;
+			}
+			ap->nruns++;
+			ap->src[r] = ap->dst[r] = 0;
+			dir[r] = 0;
+		}
+		ap->src[r] |= (Bits)1 << b;
+		ap->dst[r] |= (Bits)1 << i;
+		last[r] = b;
+	}
+	ap->anyrev = FALSE;
+	for (Count r = 0; r < ap->nruns; r++) {
+		ap->rev[r] = (dir[r] < 0);
+		if (ap->rev[r]) {
+			ap->src[r] = reverseBits(ap->src[r]);
+			ap->anyrev = TRUE;
+		}
+	}
+}
+
+// compile choice vector cv for a relation with nattrs attributes
+
+ChVecPlan compileChVec(ChVec cv, Count nattrs)
+{
+	ChVecPlan p = malloc(sizeof(struct ChVecPlanRep)
+	                     + (nattrs-1)*sizeof(AttrPlan));
+	assert(p != NULL);
+	p->nattrs = nattrs;
+#ifdef HAVE_BMI2
+	p->bmi2 = __builtin_cpu_supports("bmi2") != 0;
+#else
+	p->bmi2 = FALSE;
+#endif
+	for (Count a = 0; a < nattrs; a++) {
+		AttrPlan *ap = &p->attrs[a];
+		memset(ap, 0, sizeof(AttrPlan));
+		for (Count i = 0; i < MAXCHVEC; i++) {
+			if (cv[i].att != a) continue;
+			ap->mask |= (Bits)1 << i;
+			Count j = cv[i].bit / 8, b = cv[i].bit % 8;
+			for (Count v = 0; v < 256; v++)
+				if (v & (1 << b)) ap->table[j][v] |= (Bits)1 << i;
+		}
+		planRuns(cv, a, ap);
+	}
+	return p;
+}
+
+void freeChVecPlan(ChVecPlan p)
+{
+	free(p);
+}
+
+#ifdef HAVE_BMI2
+__attribute__((target("bmi2")))
+static Bits gatherRuns(AttrPlan *ap, Bits hash)
+{
+	Bits mah = 0;
+	Bits rhash = ap->anyrev ? reverseBits(hash) : 0;
+	for (Count r = 0; r < ap->nruns; r++)
+		mah |= _pdep_u32(_pext_u32(ap->rev[r] ? rhash : hash, ap->src[r]),
+		                 ap->dst[r]);
+	return mah;
+}
+#endif
+
+// the bits of the MAH which come from attribute att, whose value
+//  has hash value hash
+
+Bits gatherBits(ChVecPlan p, Count att, Bits hash)
+{
+	assert(att < p->nattrs);
+	AttrPlan *ap = &p->attrs[att];
+#ifdef HAVE_BMI2
+	if (p->bmi2 && ap->nruns > 0) return gatherRuns(ap, hash);
+#endif
+	return ap->table[0][hash & 0xff] | ap->table[1][(hash >> 8) & 0xff]
+	     | ap->table[2][(hash >> 16) & 0xff] | ap->table[3][hash >> 24];
+}
+
+// the positions in the MAH which come from attribute att
+
+Bits attrBits(ChVecPlan p, Count att)
+{
+	assert(att < p->nattrs);
+	return p->attrs[att].mask;
+}
@@ -8,8 +8,11 @@
 #ifndef CHVEC_H
 #define CHVEC_H 1
 
+typedef struct ChVecPlanRep *ChVecPlan;
+
 #include "defs.h"
 #include "reln.h"
+#include "bits.h"
 
 #define MAXCHVEC 32
 
@@ -19,5 +22,9 @@ typedef ChVecItem ChVec[MAXCHVEC];
 
 Status parseChVec(Reln r, char *str, ChVec cv);
 void printChVec(ChVec cv);
+ChVecPlan compileChVec(ChVec cv, Count nattrs);
+void freeChVecPlan(ChVecPlan p);
+Bits gatherBits(ChVecPlan p, Count att, Bits hash);
+Bits attrBits(ChVecPlan p, Count att);
 
 #endif
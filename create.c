@@ -1,18 +1,30 @@
 // create.c ... create an empty Relation
 // part of Multi-attribute linear-hashed files
 // Ask a query on a named file
-// Usage:  ./create  [-v]  RelName  #attrs  #pages  ChoiceVector
-// where #attrs = # of attributes in each tuple
+// Usage:  ./create  [-v]  [-n Attr]  RelName  #attrs  #pages  ChoiceVector  [PageSize  [LoadFactor  [Expansions  [HashFunc]]]]
+// where Attr = attribute (1-based) to keep a trigram index on
+//	          (see ngram.c)
+//	   #attrs = # of attributes in each tuple
 //	   #pages = initial (empty) pages in File
 //	   ChoiceVector = attr,bit:attr,bit:...
+//	   PageSize = bytes per data/overflow page (default PAGESIZE)
+//	   LoadFactor = % of primary page space to fill before
+//	                splitting (default LOADFACTOR)
+//	   Expansions = #partial expansions per doubling of the file
+//	                (default 1, i.e. ordinary linear hashing)
+//	   HashFunc = hash function for attribute values: pg (hash_any(),
+//	              the default) or xxh64
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include "util.h"
 #include "reln.h"
+#include "hash.h"
 
-#define USAGE "./create  [-v]  RelName  #attrs  #pages  ChoiceVector"
+#define USAGE "./create  [-v]  [-n Attr]  RelName  #attrs  #pages  ChoiceVector  [PageSize  [LoadFactor  [Expansions  [HashFunc]]]]"
+
+#define MAXEXPANSIONS 8
 
 
 // Main ... process args, create relation
@@ -22,24 +34,41 @@ int main(int argc, char **argv)
 	//Reln r;  // handle on the data file
 	int nattrs;  // number of attributes in each tuple
 	int npages;  // initial number of pages
+	int pagesize;  // bytes in each page
+	int loadfactor;  // target % full before splitting
+	int expansions;  // #partial expansions per doubling
+	int hash;  // hash function number (see hash.h)
 	char err[MAXERRMSG];  // buffer for error messages
-	int verbose;  // show extra info on query progress
+	int verbose = 0;  // show extra info on query progress
+	int ngramatt = 0;  // attribute to index (0 for none)
 	char *rname;  // name of table/file
 	char *attrs;   // number of attributes in tuples
 	char *pages;   // number of pages in data file
 	char *cv;	  // choice vector
+	char *psize;   // page size (NULL for default)
+	char *lfactor; // load factor (NULL for default)
+	char *nexp;    // #partial expansions (NULL for default)
+	char *hname;   // hash function name (NULL for default)
 
 	// Process command-line args
 
-	if (argc < 2) fatal(USAGE);
-	if (strcmp(argv[1], "-v") == 0) {
-		if (argc < 6) fatal(USAGE);
-	    verbose = 1; rname = argv[2]; attrs = argv[3]; pages = argv[4]; cv = argv[5];
-	}
-	else {
-		if (argc < 5) fatal(USAGE);
-	    verbose = 0; rname = argv[1]; attrs = argv[2]; pages = argv[3]; cv = argv[4];
+	int a;
+	for (a = 1; a < argc && argv[a][0] == '-'; a++) {
+		if (strcmp(argv[a], "-v") == 0)
+			verbose = 1;
+		else if (strcmp(argv[a], "-n") == 0 && a+1 < argc) {
+			ngramatt = atoi(argv[++a]);
+			if (ngramatt < 1) fatal(USAGE);
+		}
+		else
+			fatal(USAGE);
 	}
+	if (argc - a < 4) fatal(USAGE);
+	rname = argv[a]; attrs = argv[a+1]; pages = argv[a+2]; cv = argv[a+3];
+	psize = (argc > a+4) ? argv[a+4] : NULL;
+	lfactor = (argc > a+5) ? argv[a+5] : NULL;
+	nexp = (argc > a+6) ? argv[a+6] : NULL;
+	hname = (argc > a+7) ? argv[a+7] : NULL;
 
 	// how many attributes in each tuple
 	nattrs = atoi(attrs);
@@ -48,19 +77,55 @@ int main(int argc, char **argv)
 		fatal(err);
 	}
 
+	if (ngramatt > nattrs) {
+		sprintf(err, "Invalid attribute to index: %d (must be 1..%d)", ngramatt, nattrs);
+		fatal(err);
+	}
+
 	// how many initally empty pages
 	npages = atoi(pages);
 	if (npages < 1 || npages > 64) {
 		sprintf(err, "Invalid #pages: %d (must be 0 < # < 65)", nattrs);
 		fatal(err);
 	}
-	// convert to least 2^d >= npages
-	// d gives initial depth of file
-	int d = 0, np = 1;
+	// how big is each page (a power of 2)
+	pagesize = (psize == NULL) ? PAGESIZE : atoi(psize);
+	if (pagesize < MINPAGESIZE || pagesize > MAXPAGESIZE
+	    || (pagesize & (pagesize-1)) != 0) {
+		sprintf(err, "Invalid page size: %d (must be a power of 2 in %d..%d)",
+		        pagesize, MINPAGESIZE, MAXPAGESIZE);
+		fatal(err);
+	}
+	// how full to let primary pages get
+	loadfactor = (lfactor == NULL) ? LOADFACTOR : atoi(lfactor);
+	if (loadfactor < 10 || loadfactor > 1000) {
+		sprintf(err, "Invalid load factor: %d (must be 10..1000)", loadfactor);
+		fatal(err);
+	}
+
+	// how many steps to grow each bucket group by
+	expansions = (nexp == NULL) ? 1 : atoi(nexp);
+	if (expansions < 1 || expansions > MAXEXPANSIONS) {
+		sprintf(err, "Invalid #expansions: %d (must be 1..%d)",
+		        expansions, MAXEXPANSIONS);
+		fatal(err);
+	}
+
+	// which function to hash attribute values with
+	hash = (hname == NULL) ? HASH_PG : hashNumber(hname);
+	if (hash == NHASHES) {
+		sprintf(err, "Invalid hash function: %s (must be pg or xxh64)", hname);
+		fatal(err);
+	}
+
+	// convert to least expansions*2^d >= npages
+	// d gives initial depth of file (2^d groups of buckets)
+	int d = 0, np = expansions;
 	while (np < npages) { d++; np <<= 1; }
 
 	if (verbose)
-		printf("#a=%d, #p=%d, d=%d\n", nattrs, np, d);
+		printf("#a=%d, #p=%d, d=%d, pagesize=%d, loadfactor=%d%%, expansions=%d, hash=%s\n",
+		       nattrs, np, d, pagesize, loadfactor, expansions, hashName(hash));
 
 	// Open files for the Relation and initialise
 
@@ -68,9 +133,19 @@ int main(int argc, char **argv)
 		sprintf(err, "Relation %s already exists", rname);
 		fatal(err);
 	}
-	if (newRelation(rname, nattrs, np, d, cv) != OK) {
+	if (newRelation(rname, nattrs, np, d, cv, pagesize, loadfactor, expansions, hash) != OK) {
 		sprintf(err, "Problems while creating relation %s", rname);
 		fatal(err);
 	}
+
+	// start an (empty) trigram index
+	if (ngramatt > 0) {
+		Reln r = openRelation(rname, "r+");
+		if (r == NULL || indexRelation(r, ngramatt-1) != OK) {
+			sprintf(err, "Problems while indexing relation %s", rname);
+			fatal(err);
+		}
+		closeRelation(r);
+	}
 	return OK;
 }
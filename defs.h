@@ -13,7 +13,13 @@
 #include "util.h"
 
 #define PAGESIZE    1024
-#define NO_PAGE     0xffffffff
+#define MINPAGESIZE 1024
+#define MAXPAGESIZE 65536
+#define NBUFFERS    512
+#define MINBUFFERS  8
+#define PREFETCH    16
+#define LOADFACTOR  75
+#define NO_PAGE     0xffffffffffffffffULL
 #define MAXERRMSG   200
 #define MAXTUPLEN   200
 #define MAXRELNAME  200
@@ -26,7 +32,7 @@
 typedef char Bool;
 typedef unsigned char Byte;
 typedef int Status;
-typedef unsigned int Offset;
+typedef unsigned long long Offset;  // file offsets and page ids (64-bit)
 typedef unsigned int Count;
 typedef Offset PageID;
 
@@ -25,12 +25,13 @@ int main(int argc, char **argv)
 
 	if (!existsRelation(relname))
 		fatal("No such relation");
-	Reln r = openRelation(relname,"r");
+	Reln r = openRelation(relname,"rm");
 	if (r == NULL)
 		fatal("Can't open relation");
+	advisePageFile(dataFile(r), 0, 0, PF_SEQUENTIAL);
 
 	for (Offset pid = 0; pid < npages(r); pid++) {
-		printf("Bucket[%d]\n",pid);
+		printf("Bucket[%llu]\n",pid);
 		// show tuples in data file
 		Page pg = getPage(dataFile(r),pid);
 		showAllTuples(pg);
@@ -42,9 +43,9 @@ int main(int argc, char **argv)
 			ovpg = getPage(ovflowFile(r), ovp);
 			showAllTuples(ovpg);
 			ovp = pageOvflow(ovpg);
-			free(ovpg);
+			releasePage(ovpg);
 		}
-		free(pg);
+		releasePage(pg);
 	}
 	closeRelation(r);
 
@@ -56,9 +57,6 @@ int main(int argc, char **argv)
 void showAllTuples(Page pg)
 {
 		Count ntups = pageNTuples(pg);
-		char *c = pageData(pg);
-		for (int i = 0; i < ntups; i++) {
-			printf("%s\n", c);
-			c += strlen(c) + 1;
-		}
+		for (int i = 0; i < ntups; i++)
+			printf("%s\n", pageTuple(pg, i));
 }
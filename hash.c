@@ -2,6 +2,11 @@
 // part of Multi-attribute Linear-hashed Files
 // Last modified by John Shepherd, July 2019
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_SIMD 1     // can build SSE4.1/AVX2 code (if the CPU has it)
+#endif
+#include <stdint.h>
 #include "defs.h"
 #include "hash.h"
 #include "bits.h"
@@ -95,3 +100,247 @@ hash_any(unsigned char *k, int keylen)
 	final(a, b, c);
 	return c;
 }
+
+// XXH64 (Yann Collet's xxHash, 64-bit version, seed 0)
+// Reads 8 bytes at a time, so is much faster than hash_any() on
+// longer values; all 64 bits are well mixed, and the result is
+// folded to 32 bits (high half xor low half)
+
+#define PRIME1 0x9E3779B185EBCA87ULL
+#define PRIME2 0xC2B2AE3D27D4EB4FULL
+#define PRIME3 0x165667B19E3779F9ULL
+#define PRIME4 0x85EBCA77C2B2AE63ULL
+#define PRIME5 0x27D4EB2F165667C5ULL
+
+#define rot64(x,k) (((x)<<(k)) | ((x)>>(64-(k))))
+
+static inline uint64_t get64(unsigned char *k)
+{
+	uint64_t v = 0;
+	for (int i = 7; i >= 0; i--) v = (v << 8) | k[i];
+	return v;
+}
+
+static inline uint64_t get32(unsigned char *k)
+{
+	return k[0] | ((uint64_t)k[1] << 8) | ((uint64_t)k[2] << 16) | ((uint64_t)k[3] << 24);
+}
+
+static inline uint64_t round64(uint64_t acc, uint64_t v)
+{
+	acc += v * PRIME2;
+	acc = rot64(acc, 31);
+	return acc * PRIME1;
+}
+
+static inline uint64_t merge64(uint64_t h, uint64_t v)
+{
+	h ^= round64(0, v);
+	return h * PRIME1 + PRIME4;
+}
+
+Bits
+hash_xxh64(unsigned char *k, int keylen)
+{
+	unsigned char *end = k + keylen;
+	uint64_t h;
+
+	if (keylen >= 32) {
+		uint64_t v1 = PRIME1 + PRIME2, v2 = PRIME2, v3 = 0, v4 = -PRIME1;
+		do {
+			v1 = round64(v1, get64(k));
+			v2 = round64(v2, get64(k+8));
+			v3 = round64(v3, get64(k+16));
+			v4 = round64(v4, get64(k+24));
+			k += 32;
+		} while (k + 32 <= end);
+		h = rot64(v1, 1) + rot64(v2, 7) + rot64(v3, 12) + rot64(v4, 18);
+		h = merge64(h, v1);
+		h = merge64(h, v2);
+		h = merge64(h, v3);
+		h = merge64(h, v4);
+	}
+	else
+		h = PRIME5;
+	h += (uint64_t)keylen;
+
+	for (; k + 8 <= end; k += 8) {
+		h ^= round64(0, get64(k));
+		h = rot64(h, 27) * PRIME1 + PRIME4;
+	}
+	if (k + 4 <= end) {
+		h ^= get32(k) * PRIME1;
+		h = rot64(h, 23) * PRIME2 + PRIME3;
+		k += 4;
+	}
+	for (; k < end; k++) {
+		h ^= *k * PRIME5;
+		h = rot64(h, 11) * PRIME1;
+	}
+
+	h ^= h >> 33; h *= PRIME2;
+	h ^= h >> 29; h *= PRIME3;
+	h ^= h >> 32;
+	return (Bits)(h ^ (h >> 32));
+}
+
+// Hash functions, by number (as stored in a relation's .info)
+
+static struct {
+	char    *name;
+	HashFunc fn;
+} hashes[NHASHES] = {
+	[HASH_PG]    = { "pg",    hash_any },
+	[HASH_XXH64] = { "xxh64", hash_xxh64 },
+};
+
+// the hash function numbered id
+
+HashFunc hashFunction(Count id)
+{
+	assert(id < NHASHES);
+	return hashes[id].fn;
+}
+
+char *hashName(Count id)
+{
+	assert(id < NHASHES);
+	return hashes[id].name;
+}
+
+// the number of the hash function called name (NHASHES if none)
+
+Count hashNumber(char *name)
+{
+	Count id;
+	for (id = 0; id < NHASHES; id++)
+		if (strcmp(hashes[id].name, name) == 0) break;
+	return id;
+}
+
+// Hashing many keys at once
+// hash_many() gives the same results as calling hash_any() for
+// each key, but on CPUs with AVX2 (or SSE4.1) hashes 8 (or 4) keys
+// at a time, one in each 32-bit lane of a vector register. Keys
+// of different lengths share the vectors: a lane whose key has run
+// out of 12-byte blocks keeps its state (via a blend) while the
+// other lanes mix in their next block. The last 0..11 bytes of
+// each key, zero-padded to 12, are added as three words; this is
+// what the little-endian case of hash_any() does, given that the
+// lowest byte of c is reserved for the length.
+
+#ifdef HAVE_SIMD
+
+// little-endian 32-bit word at k
+static inline Bits word(unsigned char *k)
+{
+	return k[0] + ((Bits) k[1] << 8) + ((Bits) k[2] << 16) + ((Bits) k[3] << 24);
+}
+
+// the words added to a, b and c for key k's 12-byte block i (or
+//  for its tail, if it has no block i)
+static inline void blockWords(unsigned char *k, int keylen, int i, Bits *w)
+{
+	unsigned char tail[12];
+	int off = 12*i;
+	if (keylen - off < 12) {
+		memset(tail, 0, 12);
+		memcpy(tail, k + off, keylen - off);
+		w[0] = word(tail);
+		w[1] = word(tail+4);
+		w[2] = word(tail+8) << 8;
+		return;
+	}
+	w[0] = word(k+off);
+	w[1] = word(k+off+4);
+	w[2] = word(k+off+8);
+}
+
+// lane-wise versions of mix() and final()
+// P is the intrinsics' prefix (_mm_ or _mm256_), S the vector
+//  width (128 or 256); vrotS() rotates each lane
+#define VMIX(P, S, a, b, c) \
+{ \
+  a = P##sub_epi32(a, c); a = P##xor_si##S(a, vrot##S(c, 4)); c = P##add_epi32(c, b); \
+  b = P##sub_epi32(b, a); b = P##xor_si##S(b, vrot##S(a, 6)); a = P##add_epi32(a, c); \
+  c = P##sub_epi32(c, b); c = P##xor_si##S(c, vrot##S(b, 8)); b = P##add_epi32(b, a); \
+  a = P##sub_epi32(a, c); a = P##xor_si##S(a, vrot##S(c,16)); c = P##add_epi32(c, b); \
+  b = P##sub_epi32(b, a); b = P##xor_si##S(b, vrot##S(a,19)); a = P##add_epi32(a, c); \
+  c = P##sub_epi32(c, b); c = P##xor_si##S(c, vrot##S(b, 4)); b = P##add_epi32(b, a); \
+}
+
+#define VFINAL(P, S, a, b, c) \
+{ \
+  c = P##xor_si##S(c, b); c = P##sub_epi32(c, vrot##S(b,14)); \
+  a = P##xor_si##S(a, c); a = P##sub_epi32(a, vrot##S(c,11)); \
+  b = P##xor_si##S(b, a); b = P##sub_epi32(b, vrot##S(a,25)); \
+  c = P##xor_si##S(c, b); c = P##sub_epi32(c, vrot##S(b,16)); \
+  a = P##xor_si##S(a, c); a = P##sub_epi32(a, vrot##S(c, 4)); \
+  b = P##xor_si##S(b, a); b = P##sub_epi32(b, vrot##S(a,14)); \
+  c = P##xor_si##S(c, b); c = P##sub_epi32(c, vrot##S(b,24)); \
+}
+
+// define NAME(), which hashes n (<= LANES) keys in one go, using
+//  vectors of type V, and instructions available with TARGET
+#define VHASH(NAME, TARGET, V, P, S, LANES) \
+__attribute__((target(TARGET))) \
+static inline V vrot##S(V x, int k) \
+{ return P##or_si##S(P##slli_epi32(x, k), P##srli_epi32(x, 32-k)); } \
+__attribute__((target(TARGET))) \
+static void NAME(unsigned char **keys, int *keylens, int n, Bits *hashes) \
+{ \
+	Bits wa[LANES], wb[LANES], wc[LANES], w[3]; \
+	int nblocks = 0; \
+	for (int l = 0; l < n; l++) \
+		if (keylens[l]/12 > nblocks) nblocks = keylens[l]/12; \
+	V a = P##set1_epi32(0x9e3779b9), b = a, c = P##set1_epi32(3923095); \
+	for (int i = 0; i <= nblocks; i++) { \
+		Bits live[LANES]; \
+		for (int l = 0; l < LANES; l++) { \
+			Bool inkey = (l < n && 12*i <= keylens[l]); \
+			if (inkey) blockWords(keys[l], keylens[l], i, w); \
+			else w[0] = w[1] = w[2] = 0; \
+			wa[l] = w[0]; wb[l] = w[1]; wc[l] = w[2]; \
+			/* a lane mixes only whole blocks */ \
+			live[l] = (inkey && keylens[l] - 12*i >= 12) ? ~(Bits)0 : 0; \
+		} \
+		a = P##add_epi32(a, P##loadu_si##S((V *)wa)); \
+		b = P##add_epi32(b, P##loadu_si##S((V *)wb)); \
+		c = P##add_epi32(c, P##loadu_si##S((V *)wc)); \
+		if (i == nblocks) break; \
+		V m = P##loadu_si##S((V *)live); \
+		V a1 = a, b1 = b, c1 = c; \
+		VMIX(P, S, a1, b1, c1); \
+		a = P##blendv_epi8(a, a1, m); \
+		b = P##blendv_epi8(b, b1, m); \
+		c = P##blendv_epi8(c, c1, m); \
+	} \
+	VFINAL(P, S, a, b, c); \
+	Bits out[LANES]; \
+	P##storeu_si##S((V *)out, c); \
+	memcpy(hashes, out, n*sizeof(Bits)); \
+}
+
+VHASH(hash8, "avx2", __m256i, _mm256_, 256, 8)
+VHASH(hash4, "sse4.1", __m128i, _mm_, 128, 4)
+
+#endif
+
+// hash n keys; hashes[i] == hash_any(keys[i], keylens[i])
+
+void hash_many(unsigned char **keys, int *keylens, int n, Bits *hashes)
+{
+	int i = 0;
+#ifdef HAVE_SIMD
+	static int lanes = -1;  // widest vectors this CPU has
+	if (lanes < 0)
+		lanes = __builtin_cpu_supports("avx2") ? 8
+		      : __builtin_cpu_supports("sse4.1") ? 4 : 0;
+	for (; lanes == 8 && i < n; i += 8)
+		hash8(keys+i, keylens+i, (n-i < 8) ? n-i : 8, hashes+i);
+	for (; lanes == 4 && i < n; i += 4)
+		hash4(keys+i, keylens+i, (n-i < 4) ? n-i : 4, hashes+i);
+#endif
+	for (; i < n; i++)
+		hashes[i] = hash_any(keys[i], keylens[i]);
+}
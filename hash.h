@@ -6,8 +6,21 @@
 #ifndef HASH_H
 #define HASH_H 1
 
+#include "defs.h"
 #include "bits.h"
 
+// hash functions a relation can use (see create)
+#define HASH_PG    0  // hash_any(), from PostgreSQL (the default)
+#define HASH_XXH64 1  // hash_xxh64()
+#define NHASHES    2
+
+typedef Bits (*HashFunc)(unsigned char *, int);
+
 Bits hash_any(unsigned char *, int);
+Bits hash_xxh64(unsigned char *, int);
+HashFunc hashFunction(Count);
+char *hashName(Count);
+Count hashNumber(char *);
+void hash_many(unsigned char **, int *, int, Bits *);
 
 #endif
@@ -0,0 +1,40 @@
+// index.c ... build a trigram index for a relation
+// part of Multi-attribute linear-hashed files
+// Usage:  ./index  RelName  Attr
+// where Attr = attribute (1-based) whose values pattern queries
+//	          (e.g. "?,%phone%,?") will be able to look up
+//	          (see ngram.c); replaces any index the relation has
+
+#include "defs.h"
+#include "reln.h"
+
+#define USAGE "./index  RelName  Attr"
+
+// Main ... process args, build index
+
+int main(int argc, char **argv)
+{
+	char err[MAXERRMSG];  // buffer for error messages
+
+	if (argc != 3) fatal(USAGE);
+	char *rname = argv[1];
+	int att = atoi(argv[2]);
+
+	if (!existsRelation(rname)) {
+		sprintf(err, "No such relation: %s", rname);
+		fatal(err);
+	}
+	Reln r = openRelation(rname, "r+");
+	if (r == NULL) {
+		sprintf(err, "Can't open relation: %s", rname);
+		fatal(err);
+	}
+	if (att < 1 || att > nattrs(r)) {
+		sprintf(err, "Invalid attribute: %d (must be 1..%d)", att, nattrs(r));
+		fatal(err);
+	}
+	if (indexRelation(r, att-1) != OK)
+		fatal("Can't build index");
+	closeRelation(r);
+	return 0;
+}
@@ -1,14 +1,21 @@
 // insert.c ... add tuples to a relation
 // part of Multi-attribute linear-hashed files
 // Reads tuples from stdin and inserts into Reln
-// Usage:  ./insert  [-v]  RelName
+// Usage:  ./insert  [-v]  [-i]  [-B #buffers]  [--bulk | -b BatchSize]  RelName
+// --bulk builds an empty relation in one pass (see bulkLoadRelation())
+// -b inserts tuples in batches of BatchSize (see addBatchToRelation())
+// -i spreads the work of each split over later inserts (see splitStep())
+// -B sets the #frames in the buffer pool (default NBUFFERS)
 // Last modified by John Shepherd, July 2019
 
 #include "defs.h"
 #include "reln.h"
 #include "tuple.h"
+#include "buffer.h"
 
-#define USAGE "./insert  [-v]  RelName"
+#define USAGE "./insert  [-v]  [-i]  [-B #buffers]  [--bulk | -b BatchSize]  RelName"
+
+#define BATCHSIZE 64  // default #tuples per addBatchToRelation()
 
 // Main ... process args, read/insert tuples
 
@@ -16,19 +23,41 @@ int main(int argc, char **argv)
 {
 	Reln r;  // handle on the open relation
 	Tuple t;  // tuple buffer
+	Tuple *batch;  // tuples waiting to be inserted
+	PageID *pids;  // where each tuple in batch went
 	char err[2*MAXERRMSG];  // buffer for error messages
 	char tup[MAXTUPLEN];  // buffer for printable tuples
-	int verbose;  // show extra info on query progress
+	int verbose = 0;  // show extra info on query progress
+	int bulk = 0;  // load the whole input in one pass
+	int incremental = 0;  // split a page at a time
+	int batchsize = BATCHSIZE;  // #tuples inserted together
+	int nbuffers = NBUFFERS;  // #frames in buffer pool
 	char *rname;  // name of table/file
 
 	// process command-line args
 
-	if (argc < 2) fatal(USAGE);
-    if (strcmp(argv[1], "-v") == 0)
-		{ verbose = 1; rname = argv[2]; }
-	else
-		{ verbose = 0; rname = argv[1]; }
-
+	int a;
+	for (a = 1; a < argc && argv[a][0] == '-'; a++) {
+		if (strcmp(argv[a], "-v") == 0)
+			verbose = 1;
+		else if (strcmp(argv[a], "--bulk") == 0)
+			bulk = 1;
+		else if (strcmp(argv[a], "-i") == 0)
+			incremental = 1;
+		else if (strcmp(argv[a], "-B") == 0 && a+1 < argc) {
+			nbuffers = atoi(argv[++a]);
+			if (nbuffers < MINBUFFERS) fatal(USAGE);
+		}
+		else if (strcmp(argv[a], "-b") == 0 && a+1 < argc) {
+			batchsize = atoi(argv[++a]);
+			if (batchsize < 1) fatal(USAGE);
+		}
+		else
+			fatal(USAGE);
+	}
+	if (a != argc-1) fatal(USAGE);
+	rname = argv[a];
+	initBufferPool(nbuffers);
 
 	// set up relation for writing
 
@@ -36,25 +65,45 @@ int main(int argc, char **argv)
 		sprintf(err, "No such relation: %s", rname);
 		fatal(err);
 	}
-	if ((r = openRelation(rname,"r+")) == NULL) {
-		sprintf(err, "Can't open relation: %s",argv[1]);
+	if ((r = openRelation(rname,incremental ? "r+i" : "r+")) == NULL) {
+		sprintf(err, "Can't open relation: %s",rname);
 		fatal(err);
 	}
 
-	// read stdin and insert tuples
+	// bulk load: read and insert all of stdin at once
 
-	while ((t = readTuple(r,stdin)) != NULL) {
-		PageID pid;
-		pid = addToRelation(r,t);
+	if (bulk) {
+		if (bulkLoadRelation(r,stdin) != OK)
+			fatal("Bulk load failed");
+		if (verbose) relationStats(r);
+		closeRelation(r);
+		return 0;
+	}
 
-		tupleString(t,tup); // printable version
-		if (pid == NO_PAGE) {
-			sprintf(err, "Insert of %s failed\n", tup);
-			fatal(err);
+	// read stdin and insert tuples, batchsize at a time
+
+	batch = malloc(batchsize*sizeof(Tuple));
+	pids = malloc(batchsize*sizeof(PageID));
+	if (batch == NULL || pids == NULL) fatal("Out of memory");
+	for (;;) {
+		int n = 0;
+		while (n < batchsize && (t = readTuple(r,stdin)) != NULL)
+			batch[n++] = t;
+		if (n == 0) break;
+		addBatchToRelation(r, batch, n, pids);
+
+		for (int i = 0; i < n; i++) {
+			tupleString(batch[i],tup); // printable version
+			if (pids[i] == NO_PAGE) {
+				sprintf(err, "Insert of %s failed\n", tup);
+				fatal(err);
+			}
+			if (verbose) printf("%s -> %llu\n",tup,pids[i]);
+			free(batch[i]);
 		}
-		if (verbose) printf("%s -> %d\n",tup,pid);
-		free(t);
 	}
+	free(batch);
+	free(pids);
 
 	// clean up
 
@@ -0,0 +1,181 @@
+// ngram.c ... trigram indexes
+// part of Multi-attribute Linear-hashed Files
+// A relation may have a trigram index on one attribute, in the
+// file RelName.ngram, so that pattern queries on the attribute
+// (e.g. "?,%phone%,?"), which the MAH can't help with, need only
+// visit buckets which could hold a match.
+// For each bucket, the index holds a signature of NGRAMBITS bits:
+// each trigram (3 consecutive chars) of the attribute's values in
+// the bucket's tuples sets the bit its hash selects. A bucket can
+// only hold a match for a pattern if the bits for all trigrams in
+// the pattern's literal segments are set.
+// Signatures are only ever added to as tuples are inserted, so
+// may still have bits for tuples which have since moved to other
+// buckets; a split rewrites the signatures of the buckets in the
+// group it expands.
+// The whole index is held in memory while the relation is open,
+// and written back when it is closed. The relation's .info notes
+// whether the index is in sync with the data files; an index left
+// out of sync (by a session which didn't close the relation) is
+// ignored until rebuilt (see openRelation()).
+// File layout: NGRAMMAGIC, a Count for each of the attribute,
+// NGRAMBITS and #buckets, then each bucket's signature
+
+#include "defs.h"
+#include "ngram.h"
+#include "tuple.h"
+
+#define NGRAMMAGIC 0x4e47524d
+#define NGRAMBITS  4096  // signature bits per bucket (a power of 2)
+#define SIGBYTES   (NGRAMBITS/8)
+
+struct NgramIndexRep {
+	char   fname[MAXFILENAME]; // the .ngram file
+	Count  att;     // the indexed attribute (0-based)
+	Count  nbuckets;// #buckets with a signature
+	Count  max;     // #buckets there is room for
+	Byte  *sigs;    // the signatures, SIGBYTES each
+	Bool   dirty;   // changed since loaded?
+};
+
+// signature of bucket b, making room for it if need be
+
+static Byte *sigOf(NgramIndex x, PageID b)
+{
+	if (b >= x->max) {
+		Count max = (x->max == 0) ? 64 : x->max;
+		while (max <= b) max *= 2;
+		x->sigs = realloc(x->sigs, (size_t)max*SIGBYTES);
+		assert(x->sigs != NULL);
+		x->max = max;
+	}
+	if (b >= x->nbuckets) {
+		memset(x->sigs + (size_t)x->nbuckets*SIGBYTES, 0,
+		       (size_t)(b+1 - x->nbuckets)*SIGBYTES);
+		x->nbuckets = b+1;
+	}
+	return x->sigs + (size_t)b*SIGBYTES;
+}
+
+// a new, empty index on attribute att for relation name
+
+NgramIndex newNgramIndex(char *name, Count att)
+{
+	NgramIndex x = malloc(sizeof(struct NgramIndexRep));
+	assert(x != NULL);
+	sprintf(x->fname, "%s.ngram", name);
+	x->att = att;
+	x->nbuckets = x->max = 0;
+	x->sigs = NULL;
+	x->dirty = TRUE;
+	return x;
+}
+
+// the index for relation name, or NULL if it has none
+
+NgramIndex loadNgramIndex(char *name)
+{
+	char fname[MAXFILENAME];
+	sprintf(fname, "%s.ngram", name);
+	FILE *f = fopen(fname, "r");
+	if (f == NULL) return NULL;
+	Count hdr[4];
+	if (fread(hdr, sizeof(Count), 4, f) != 4 || hdr[0] != NGRAMMAGIC)
+		fatal("Relation has an invalid .ngram file");
+	if (hdr[2] != NGRAMBITS)
+		fatal("Relation's .ngram file has unknown signature size");
+	NgramIndex x = newNgramIndex(name, hdr[1]);
+	x->dirty = FALSE;
+	if (hdr[3] > 0) {
+		sigOf(x, hdr[3]-1);
+		size_t n = fread(x->sigs, SIGBYTES, hdr[3], f);
+		assert(n == hdr[3]);
+	}
+	fclose(f);
+	return x;
+}
+
+// write the index back to its file, if it has changed
+
+void saveNgramIndex(NgramIndex x)
+{
+	if (!x->dirty) return;
+	FILE *f = fopen(x->fname, "w");
+	if (f == NULL) fatal("Can't write .ngram file");
+	Count hdr[4] = { NGRAMMAGIC, x->att, NGRAMBITS, x->nbuckets };
+	size_t n = fwrite(hdr, sizeof(Count), 4, f);
+	assert(n == 4);
+	n = fwrite(x->sigs, SIGBYTES, x->nbuckets, f);
+	assert(n == x->nbuckets);
+	fclose(f);
+	x->dirty = FALSE;
+}
+
+void freeNgramIndex(NgramIndex x)
+{
+	if (x == NULL) return;
+	free(x->sigs);
+	free(x);
+}
+
+Count ngramAttr(NgramIndex x) { return x->att; }
+
+// hash of the trigram at c
+
+static inline Bits trigram(char *c)
+{
+	Bits h = (Byte)c[0] | ((Bits)(Byte)c[1] << 8) | ((Bits)(Byte)c[2] << 16);
+	h *= 0x9e3779b1u;
+	return h >> 20;  // NGRAMBITS = 2^12
+}
+
+// forget what is in bucket b (before it is rewritten)
+
+void ngramClearBucket(NgramIndex x, PageID b)
+{
+	memset(sigOf(x, b), 0, SIGBYTES);
+	x->dirty = TRUE;
+}
+
+// note that tuple t is in bucket b
+
+void ngramAddTuple(NgramIndex x, PageID b, Tuple t)
+{
+	Field f[x->att+1];
+	if (tupleFields(t, f, x->att+1) <= x->att) return;
+	Byte *sig = sigOf(x, b);
+	for (int i = 0; i+3 <= f[x->att].len; i++) {
+		Bits k = trigram(f[x->att].val + i);
+		sig[k/8] |= 1 << (k%8);
+	}
+	x->dirty = TRUE;
+}
+
+// the keys of the trigrams in the literal segments of pattern
+//  val (len chars); at most max of them are put in keys[]
+// returns how many there are (0 if the pattern has no segment
+//  of 3 or more chars, so can't use the index)
+
+Count ngramKeys(char *val, int len, Bits *keys, Count max)
+{
+	Count n = 0;
+	int seg = 0;  // #literal chars before i in this segment
+	for (int i = 0; i < len && n < max; i++) {
+		if (val[i] == '%') { seg = 0; continue; }
+		if (++seg >= 3) keys[n++] = trigram(val + i - 2);
+	}
+	return n;
+}
+
+// could bucket b hold a value with all of the trigrams whose
+//  keys are keys[0..nkeys-1]?
+// buckets the index knows nothing of could hold anything
+
+Bool ngramMayMatch(NgramIndex x, PageID b, Bits *keys, Count nkeys)
+{
+	if (b >= x->nbuckets) return TRUE;
+	Byte *sig = x->sigs + (size_t)b*SIGBYTES;
+	for (Count i = 0; i < nkeys; i++)
+		if (!(sig[keys[i]/8] & (1 << (keys[i]%8)))) return FALSE;
+	return TRUE;
+}
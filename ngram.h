@@ -0,0 +1,24 @@
+// ngram.h ... interface to trigram indexes
+// part of Multi-attribute Linear-hashed Files
+// See ngram.c for details of NgramIndex type and functions
+
+#ifndef NGRAM_H
+#define NGRAM_H 1
+
+typedef struct NgramIndexRep *NgramIndex;
+
+#include "defs.h"
+#include "tuple.h"
+#include "bits.h"
+
+NgramIndex newNgramIndex(char *name, Count att);
+NgramIndex loadNgramIndex(char *name);
+void saveNgramIndex(NgramIndex x);
+void freeNgramIndex(NgramIndex x);
+Count ngramAttr(NgramIndex x);
+void ngramClearBucket(NgramIndex x, PageID b);
+void ngramAddTuple(NgramIndex x, PageID b, Tuple t);
+Count ngramKeys(char *val, int len, Bits *keys, Count max);
+Bool ngramMayMatch(NgramIndex x, PageID b, Bits *keys, Count nkeys);
+
+#endif
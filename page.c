@@ -3,102 +3,460 @@
 // Reading/writing pages into buffers and manipulating contents
 // Last modified by John Shepherd, July 2019
 
+#include <stddef.h>
 #include "defs.h"
 #include "page.h"
+#include "buffer.h"
 
 // internal representation of pages
 struct PageRep {
-	Offset free;   // offset within data[] of free space
-	Offset ovflow; // Offset of overflow page (if any)
-	Count ntuples; // #tuples in this page
-	char data[1];  // start of data
+	Count  format;  // PAGEMAGIC|version of page layout
+	Count  size;    // #bytes in page
+	Count  free;    // offset within data[] of free space
+	Count  ntuples; // #tuples (and #slots) in this page
+	Offset ovflow;  // Offset of overflow page (if any)
+	char   data[1]; // start of data
 };
 
-// A Page is a chunk of memory containing PAGESIZE bytes
-// It is implemented as a struct (free, ovflow, data[1])
+// A Page is a chunk of memory containing size bytes
+// It is implemented as a struct (format, size, free, ntuples, ovflow, data[1])
+// - format identifies the page layout (see below)
 // - free is the offset of the first byte of free space
 // - ovflow is the page id of the next overflow page in bucket
-// - data[] is a sequence of bytes containing tuples
+// - data[] holds tuples from the front and a slot directory
+//   growing backwards from the end of the page
+// - slot k gives the (offset,length) of tuple k within data[],
+//   and the tuple's multi-attribute hash value, so that tuples
+//   can be placed in buckets, and ruled out by queries, without
+//   hashing their attribute values again
+// - the last size/BLOOMRATIO bytes of the page, after the slot
+//   directory, are a Bloom filter of the (attribute, value) pairs
+//   in its tuples, so that queries can rule out a whole page
+//   (see pageMayHold()); in a bucket's primary page, the filter
+//   covers every page in the bucket's chain, so that a query can
+//   skip the chain without reading its overflow pages
 // - each tuple is a sequence of chars terminated by '\0'
 // - PageID values count # pages from start of file
 
-// create a new initially empty page in memory
-Page newPage()
+#define PAGEMAGIC   0x4d480000
+#define PAGEFORMAT  5
+#define PAGEHDR     offsetof(struct PageRep, data)
+#define BLOOMRATIO  16  // page size / Bloom filter size
+
+typedef struct { unsigned short off, len; Bits hash; } Slot;
+typedef struct { unsigned short off, len; } SlotV3;
+
+// Older page formats can still be read, and added to,
+// but new pages are always created in the current format
+// - format 4 pages have the current layout, without the Bloom
+//   filter (so can't be ruled out)
+// - format 3 pages have the current layout, except that slots
+//   have no hash value
+// - format 1 pages (before slot directories were added) have
+//   no format word, are always PAGESIZE bytes, and hold only
+//   back-to-back tuples
+// - format 2 pages have the current layout, except that ovflow
+//   is a 32-bit page id
+// In both, NO_PAGE is stored as 0xffffffff
+struct PageRepV1 {
+	unsigned int free;    // offset within data[] of free space
+	unsigned int ovflow;  // Offset of overflow page (if any)
+	unsigned int ntuples; // #tuples in this page
+	char data[1];         // start of data
+};
+
+struct PageRepV2 {
+	Count  format;        // PAGEMAGIC|2
+	Count  size;          // #bytes in page
+	Count  free;          // offset within data[] of free space
+	Count  ntuples;       // #tuples (and #slots) in this page
+	unsigned int ovflow;  // Offset of overflow page (if any)
+	char   data[1];       // start of data
+};
+
+#define V1(p)       ((struct PageRepV1 *)(p))
+#define V2(p)       ((struct PageRepV2 *)(p))
+#define V1HDR       offsetof(struct PageRepV1, data)
+#define V2HDR       offsetof(struct PageRepV2, data)
+#define OLD_NO_PAGE 0xffffffff
+
+// which format is the page in?
+static Count formatOf(Page p)
+{
+	if ((p->format & 0xffff0000) != PAGEMAGIC) return 1;
+	return p->format & 0xffff;
+}
+#define isV1(p)     (formatOf(p) == 1)
+
+// #bytes before data[] (slotted formats only)
+static Count headerSize(Page p)
+{
+	return (formatOf(p) == 2) ? V2HDR : PAGEHDR;
+}
+
+// #bytes in each slot (slotted formats only)
+static Count slotSize(Page p)
+{
+	return (formatOf(p) >= 4) ? sizeof(Slot) : sizeof(SlotV3);
+}
+
+// #bytes in the page's Bloom filter (0 before format 5)
+static Count filterSize(Page p)
+{
+	return (formatOf(p) >= 5) ? p->size/BLOOMRATIO : 0;
+}
+
+// the page's Bloom filter (format 5 only)
+static Byte *filterOf(Page p)
+{
+	return (Byte *)p + p->size - filterSize(p);
+}
+
+// slot directory entry for tuple k (slotted formats only)
+// in formats before 4, only off and len are present
+static Slot *slotOf(Page p, Count k)
 {
-	Page p = malloc(PAGESIZE);
-	assert(p != NULL);
+	return (Slot *)(filterOf(p) - (k+1)*slotSize(p));
+}
+
+// set up an empty page of size bytes in the given format (3 or 5)
+static void initPage(Page p, Count size, Count format)
+{
+	p->format = PAGEMAGIC|format;
+	p->size = size;
 	p->free = 0;
 	p->ovflow = NO_PAGE;
 	p->ntuples = 0;
-	Count hdr_size = 2*sizeof(Offset) + sizeof(Count);
-	int dataSize = PAGESIZE - hdr_size;
-	memset(p->data, 0, dataSize);
+	memset(p->data, 0, size-PAGEHDR);
+}
+
+// create a new initially empty page in memory
+Page newPage(Count size)
+{
+	assert(size >= MINPAGESIZE && size <= MAXPAGESIZE);
+	Page p = (Page)allocBlock(size);
+	initPage(p, size, PAGEFORMAT);
 	return p;
 }
 
+// #bytes in a page
+static Count pageSize(Page p)
+{
+	return isV1(p) ? PAGESIZE : p->size;
+}
+
+// rewrite a page held in format 1 or 2 in format 3
+// (format 4 and later need tuples' hash values, which only the
+//  relation can compute, and a primary page's filter covers its
+//  whole chain; such pages reach the current format when their
+//  bucket is next split)
+// only possible if its tuples still fit (format 3 has a larger
+//  header, and a slot for each tuple)
+// returns FALSE, leaving the page untouched, if they don't
+static Bool upgradePage(Page p)
+{
+	if (formatOf(p) >= 3) return TRUE;
+	Count size = pageSize(p);
+	Page new = (Page)allocBlock(size);
+	initPage(new, size, 3);
+	new->ovflow = pageOvflow(p);
+	for (Count k = 0; k < pageNTuples(p); k++) {
+		if (addToPage(new, pageTuple(p,k), 0) != OK) {
+			free(new);
+			return FALSE;
+		}
+	}
+	memcpy(p, new, size);
+	free(new);
+	return TRUE;
+}
+
 // append a new Page to a file; return its PageID
-PageID addPage(FILE *f)
-{
-	int ok = fseek(f, 0, SEEK_END);
-	assert(ok == 0);
-	int pos = ftell(f);
-	assert(pos >= 0);
-	PageID pid = pos/PAGESIZE;
-	Page p = newPage();
-	ok = putPage(f, pid, p);
-	assert(ok == 0);
+// the empty page is written straight to the file, so that
+//  the end of the file always tells us the next PageID
+PageID addPage(PageFile f)
+{
+	return appendPage(f, newPage(filePageSize(f)));
+}
+
+// append a Page from newPage() to a file, writing it straight
+//  out rather than via the buffer pool; return its PageID
+PageID appendPage(PageFile f, Page p)
+{
+	assert(pageSize(p) == filePageSize(f));
+	PageID pid = appendBlock(f, (Byte *)p);
+	free(p);
 	return pid;
 }
 
-// fetch a Page from a file; allocate a memory buffer
-Page getPage(FILE *f, PageID pid)
+// fetch a Page from a file
+// mapped files: return a pointer into the mapping
+// otherwise: pin it in the buffer pool
+// caller must eventually putPage() or releasePage() it
+Page getPage(PageFile f, PageID pid)
 {
 	assert(pid >= 0);
-	Page p = malloc(PAGESIZE);
-	assert(p != NULL);
-	int ok = fseek(f, pid*PAGESIZE, SEEK_SET);
-	assert(ok == 0);
-	int n = fread(p, 1, PAGESIZE, f);
-	assert(n == PAGESIZE);
-	return p;
+	Byte *pg = mappedBlock(f, pid);
+	if (pg != NULL) return (Page)pg;
+	return (Page)pinPage(f, pid, TRUE);
 }
 
-// write a Page to a file; release allocated buffer
-Status putPage(FILE *f, PageID pid, Page p)
+// start fetching a Page which will soon be wanted by getPage()
+// mapped files: ask the OS to fault it in
+// otherwise: start reading it into the buffer pool
+void prefetchPage(PageFile f, PageID pid)
+{
+	if (mappedBlock(f, pid) != NULL)
+		advisePageFile(f, pid, 1, PF_WILLNEED);
+	else
+		prefetchBuffer(f, pid);
+}
+
+// write a Page to a file; release the buffer
+// the page goes to the buffer pool and reaches the file when
+//  it is evicted or the relation is closed
+// p may be a page from getPage() or a page from newPage()
+// pages in older formats are upgraded as they are written, if
+//  they fit, so relations migrate to the current format as
+//  they are updated
+Status putPage(PageFile f, PageID pid, Page p)
 {
 	assert(pid >= 0);
-	int ok = fseek(f, pid*PAGESIZE, SEEK_SET);
-	assert(ok == 0);
-	int n = fwrite(p, 1, PAGESIZE, f);
-	assert(n == PAGESIZE);
+	upgradePage(p);
+	if (isBuffered((Byte *)p)) {
+		unpinPage((Byte *)p, TRUE);
+		return OK;
+	}
+	assert(pageSize(p) == filePageSize(f));
+	Byte *pg = mappedBlock(f, pid);
+	if (pg != NULL) {
+		// pages from the mapping were updated in place
+		if ((Byte *)p != pg) {
+			memcpy(pg, p, pageSize(p));
+			free(p);
+		}
+		return OK;
+	}
+	Byte *buf = pinPage(f, pid, FALSE);
+	memcpy(buf, p, pageSize(p));
+	unpinPage(buf, TRUE);
 	free(p);
-	return 0;
+	return OK;
 }
 
-// insert a tuple into a page
+// release a Page without writing it
+void releasePage(Page p)
+{
+	if (isBuffered((Byte *)p))
+		unpinPage((Byte *)p, FALSE);
+	else if (!inMapping((Byte *)p))
+		free(p);
+}
+
+// make a private (unpinned) copy of a Page
+Page clonePage(Page p)
+{
+	Page new = malloc(pageSize(p));
+	assert(new != NULL);
+	memcpy(new, p, pageSize(p));
+	return new;
+}
+
+// #bytes available for tuples in an empty page of size bytes
+Count pageCapacity(Count size)
+{
+	return size - PAGEHDR - size/BLOOMRATIO;
+}
+
+// #bytes of a page's capacity that a tuple uses
+Count tupleSpace(Tuple t)
+{
+	return tupLength(t) + 1 + sizeof(Slot);
+}
+
+// insert a tuple, whose hash value is h, into a page
+// (h is not kept in pages in formats before 4)
 // returns 0 status if successful
 // returns -1 if not enough room
-Status addToPage(Page p, Tuple t)
+Status addToPage(Page p, Tuple t, Bits h)
 {
 	int n = tupLength(t);
-	char *c = p->data + p->free;
-	Count hdr_size = 2*sizeof(Offset) + sizeof(Count);
+	if (isV1(p)) {
+		struct PageRepV1 *p1 = V1(p);
+		char *c = p1->data + p1->free;
+		if (c+n > &p1->data[PAGESIZE-V1HDR-2]) return -1;
+		strcpy(c, t);
+		p1->free += n+1;
+		p1->ntuples++;
+		return OK;
+	}
 	// doesn't fit ... return fail code
 	// assume caller will put it elsewhere
-	if (c+n > &p->data[PAGESIZE-hdr_size-2]) return -1;
-	strcpy(c, t);
+	if (n+1+slotSize(p) > pageFreeSpace(p)) return -1;
+	Slot *s = slotOf(p, p->ntuples);
+	s->off = p->free;
+	s->len = n;
+	if (formatOf(p) >= 4) s->hash = h;
+	memcpy(pageData(p) + p->free, t, n+1);
 	p->free += n+1;
 	p->ntuples++;
+	pageFilterTuple(p, t);
 	return OK;
 }
 
+// Bloom filters
+// Each (attribute, value) pair has a 32-bit key (filterKey());
+// two bits of the filter, chosen by the two halves of the key,
+// are set for each pair in the page. A page can only hold tuples
+// with given values if all of their keys' bits are set.
+
+// key for value val (len chars) of attribute att
+// FNV-1a, with the attribute mixed in and the bits spread
+//  (murmur3's finaliser) so that both halves are usable
+Bits filterKey(Count att, char *val, int len)
+{
+	Bits h = 2166136261u;
+	for (int i = 0; i < len; i++) {
+		h ^= (Byte)val[i];
+		h *= 16777619u;
+	}
+	h ^= (att+1) * 0x9e3779b9u;
+	h ^= h >> 16; h *= 0x85ebca6bu;
+	h ^= h >> 13; h *= 0xc2b2ae35u;
+	h ^= h >> 16;
+	return h;
+}
+
+// add key to filter f of nbits bits (a power of 2)
+static inline void setKey(Byte *f, Count nbits, Bits key)
+{
+	Count i = key & (nbits-1), j = (key >> 16) & (nbits-1);
+	f[i/8] |= 1 << (i%8);
+	f[j/8] |= 1 << (j%8);
+}
+
+static inline Bool hasKey(Byte *f, Count nbits, Bits key)
+{
+	Count i = key & (nbits-1), j = (key >> 16) & (nbits-1);
+	return (f[i/8] & (1 << (i%8))) && (f[j/8] & (1 << (j%8)));
+}
+
+// does the page have a Bloom filter?
+Bool pageHasFilter(Page p)
+{
+	return formatOf(p) >= 5;
+}
+
+// add tuple t's values to the page's filter (without storing t)
+// used to keep a primary page's filter covering its whole chain
+void pageFilterTuple(Page p, Tuple t)
+{
+	if (!pageHasFilter(p)) return;
+	Byte *f = filterOf(p);
+	Count nbits = 8*filterSize(p);
+	Count att = 0;
+	char *c0 = t;
+	for (char *c = t; ; c++) {
+		if (*c != ',' && *c != '\0') continue;
+		setKey(f, nbits, filterKey(att++, c0, c - c0));
+		if (*c == '\0') break;
+		c0 = c+1;
+	}
+}
+
+// add everything in src's filter to dst's filter
+// if src has no filter, dst's has every bit set, as src could
+//  hold any values
+void pageCopyFilter(Page dst, Page src)
+{
+	if (!pageHasFilter(dst)) return;
+	Byte *f = filterOf(dst);
+	Count size = filterSize(dst);
+	if (!pageHasFilter(src) || filterSize(src) != size) {
+		memset(f, 0xff, size);
+		return;
+	}
+	Byte *g = filterOf(src);
+	for (Count i = 0; i < size; i++) f[i] |= g[i];
+}
+
+// could the page (or, for a primary page, its chain) hold a
+//  tuple with the values whose keys are keys[0..nkeys-1]?
+// pages without a filter could hold anything
+Bool pageMayHold(Page p, Bits *keys, Count nkeys)
+{
+	if (!pageHasFilter(p)) return TRUE;
+	Byte *f = filterOf(p);
+	Count nbits = 8*filterSize(p);
+	for (Count i = 0; i < nkeys; i++)
+		if (!hasKey(f, nbits, keys[i])) return FALSE;
+	return TRUE;
+}
+
+// fetch tuple k from a page
+// format 1 pages have no slots, so need a scan to find it
+Tuple pageTuple(Page p, Count k)
+{
+	if (isV1(p)) {
+		char *c = V1(p)->data;
+		while (k-- > 0) c += strlen(c) + 1;
+		return c;
+	}
+	assert(k < p->ntuples);
+	return pageData(p) + slotOf(p,k)->off;
+}
+
+// does the page hold tuples' hash values?
+Bool pageHasHashes(Page p)
+{
+	return formatOf(p) >= 4;
+}
+
+// fetch the hash value of tuple k from a page
+// only for pages where pageHasHashes()
+Bits pageTupleHash(Page p, Count k)
+{
+	assert(pageHasHashes(p) && k < p->ntuples);
+	return slotOf(p,k)->hash;
+}
+
 // extract page info
-char *pageData(Page p) { return p->data; }
-Count pageNTuples(Page p) { return p->ntuples; }
-Offset pageOvflow(Page p) { return p->ovflow; }
-void pageSetOvflow(Page p, PageID pid) { p->ovflow = pid; }
+char *pageData(Page p) {
+	switch (formatOf(p)) {
+	case 1:  return V1(p)->data;
+	case 2:  return V2(p)->data;
+	default: return p->data;
+	}
+}
+Count pageNTuples(Page p) { return isV1(p) ? V1(p)->ntuples : p->ntuples; }
+Offset pageOvflow(Page p) {
+	unsigned int ov;
+	switch (formatOf(p)) {
+	case 1:  ov = V1(p)->ovflow; break;
+	case 2:  ov = V2(p)->ovflow; break;
+	default: return p->ovflow;
+	}
+	return (ov == OLD_NO_PAGE) ? NO_PAGE : ov;
+}
+void pageSetOvflow(Page p, PageID pid) {
+	if (formatOf(p) > 2) {
+		p->ovflow = pid;
+		return;
+	}
+	// older formats only hold 32-bit page ids
+	if (pid != NO_PAGE && pid >= OLD_NO_PAGE) {
+		if (!upgradePage(p)) fatal("Page id too large for old-format page");
+		p->ovflow = pid;
+		return;
+	}
+	unsigned int ov = (pid == NO_PAGE) ? OLD_NO_PAGE : pid;
+	if (isV1(p))
+		V1(p)->ovflow = ov;
+	else
+		V2(p)->ovflow = ov;
+}
 Count pageFreeSpace(Page p) {
-	Count hdr_size = 2*sizeof(Offset) + sizeof(Count);
-	return (PAGESIZE-hdr_size-p->free);
+	if (isV1(p))
+		return (PAGESIZE-V1HDR-V1(p)->free);
+	return (p->size-headerSize(p)-filterSize(p)-p->free-p->ntuples*slotSize(p));
 }
-
@@ -10,16 +10,32 @@ typedef struct PageRep *Page;
 
 #include "defs.h"
 #include "tuple.h"
+#include "pagefile.h"
+#include "bits.h"
 
-Page newPage();
-PageID addPage(FILE *);
-Page getPage(FILE *, PageID);
-Status putPage(FILE *, PageID, Page);
-Status addToPage(Page, Tuple);
+Page newPage(Count);
+PageID addPage(PageFile);
+PageID appendPage(PageFile, Page);
+Page getPage(PageFile, PageID);
+void prefetchPage(PageFile, PageID);
+Status putPage(PageFile, PageID, Page);
+void releasePage(Page);
+Page clonePage(Page);
+Status addToPage(Page, Tuple, Bits);
+Tuple pageTuple(Page, Count);
+Bool pageHasHashes(Page);
+Bits pageTupleHash(Page, Count);
+Bits filterKey(Count, char *, int);
+Bool pageHasFilter(Page);
+void pageFilterTuple(Page, Tuple);
+void pageCopyFilter(Page, Page);
+Bool pageMayHold(Page, Bits *, Count);
 char *pageData(Page);
 Count pageNTuples(Page);
 Offset pageOvflow(Page);
 void pageSetOvflow(Page, PageID);
 Count pageFreeSpace(Page);
+Count pageCapacity(Count);
+Count tupleSpace(Tuple);
 
 #endif
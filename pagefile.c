@@ -0,0 +1,268 @@
+// pagefile.c ... files of fixed-size pages
+// part of Multi-attribute Linear-hashed Files
+// All page I/O on .data and .ovflow files goes through here,
+// using pread()/pwrite() on a file descriptor, so there is no
+// shared file position (or stdio buffer) between users of a file
+
+#define _GNU_SOURCE     // for O_DIRECT
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "defs.h"
+#include "pagefile.h"
+
+// alignment of page buffers, as needed for O_DIRECT
+#define BLOCKALIGN  4096
+
+// virtual address space reserved for each mapped file
+// the reservation is inaccessible, and so costs no memory; the
+//  file is mapped over the start of it, and as the file grows,
+//  more of it is mapped in place, so pages never move
+#define MAPRESERVE  ((size_t)1 << (sizeof(void *) >= 8 ? 40 : 30))
+
+// A PageFile is an open file holding pages of pagesize bytes
+// - npages tracks the length of the file, so appending a page
+//   needs no lseek()
+// - direct is set while the file is open with O_DIRECT
+// - files which are mapped are accessed via base rather than
+//   pread()/pwrite(); size is the length of the file, and
+//   mapped the length of the mapping (a multiple of the VM
+//   page size)
+// - next links all open files (for inMapping())
+
+struct PageFileRep {
+	int       fd;       // file descriptor
+	Count     pagesize; // #bytes in each page
+	Offset    npages;   // #pages in file
+	Bool      direct;   // bypassing the page cache?
+	Byte     *base;     // start of mapping (NULL if not mapped)
+	size_t    size;     // current length of file (if mapped)
+	size_t    mapped;   // #bytes of the file mapped
+	Bool      writable; // is the mapping writable?
+	PageFile  next;     // next open file
+};
+
+static PageFile openFiles = NULL;
+
+// open a file of pages; mode is "r", "r+" or "w" as for fopen()
+// with PF_DIRECT, ask for O_DIRECT, but quietly carry on through
+//  the page cache on file systems which don't support it
+// returns NULL if the file can't be opened
+
+PageFile openPageFile(char *name, char *mode, Count pagesize, int flags)
+{
+	int oflags;
+	if (mode[0] == 'w')
+		oflags = O_RDWR|O_CREAT|O_TRUNC;
+	else if (strchr(mode,'+') != NULL)
+		oflags = O_RDWR;
+	else
+		oflags = O_RDONLY;
+	int fd = -1;
+	Bool direct = FALSE;
+#ifdef O_DIRECT
+	if (flags & PF_DIRECT) {
+		fd = open(name, oflags|O_DIRECT, 0644);
+		direct = (fd >= 0);
+	}
+#endif
+	if (fd < 0) fd = open(name, oflags, 0644);
+	if (fd < 0) return NULL;
+	struct stat st;
+	if (fstat(fd, &st) < 0) { close(fd); return NULL; }
+	PageFile f = malloc(sizeof(struct PageFileRep));
+	assert(f != NULL);
+	f->fd = fd;
+	f->pagesize = pagesize;
+	f->npages = st.st_size / pagesize;
+	f->direct = direct;
+	f->base = NULL;
+	f->size = 0;
+	f->mapped = 0;
+	f->writable = FALSE;
+	f->next = openFiles;
+	openFiles = f;
+	return f;
+}
+
+// close a file; any buffered pages must already be written
+
+void closePageFile(PageFile f)
+{
+	PageFile *fp = &openFiles;
+	while (*fp != f) fp = &(*fp)->next;
+	*fp = f->next;
+	if (f->base != NULL) munmap(f->base, MAPRESERVE);
+	close(f->fd);
+	free(f);
+}
+
+Count filePageSize(PageFile f) { return f->pagesize; }
+int fileDescriptor(PageFile f) { return f->fd; }
+Offset fileNPages(PageFile f) { return f->npages; }
+
+// allocate a buffer suitably aligned for direct I/O
+// may be released with free()
+
+Byte *allocBlock(Count size)
+{
+	void *buf;
+	if (posix_memalign(&buf, BLOCKALIGN, size) != 0)
+		fatal("Out of memory for page buffers");
+	return buf;
+}
+
+// O_DIRECT has alignment rules on offsets and sizes that depend
+//  on the device; if they aren't met, fall back to the page cache
+
+static Bool directFailed(PageFile f)
+{
+	if (!f->direct || errno != EINVAL) return FALSE;
+#ifdef O_DIRECT
+	int fl = fcntl(f->fd, F_GETFL);
+	if (fl < 0 || fcntl(f->fd, F_SETFL, fl & ~O_DIRECT) < 0) return FALSE;
+#endif
+	f->direct = FALSE;
+	return TRUE;
+}
+
+// read page pid into buf
+
+void readBlock(PageFile f, PageID pid, Byte *buf)
+{
+	off_t off = (off_t)pid*f->pagesize;
+	ssize_t n = pread(f->fd, buf, f->pagesize, off);
+	if (n < 0 && directFailed(f))
+		n = pread(f->fd, buf, f->pagesize, off);
+	if (n != f->pagesize) fatal("Can't read page");
+}
+
+// write buf as page pid
+
+void writeBlock(PageFile f, PageID pid, Byte *buf)
+{
+	off_t off = (off_t)pid*f->pagesize;
+	ssize_t n = pwrite(f->fd, buf, f->pagesize, off);
+	if (n < 0 && directFailed(f))
+		n = pwrite(f->fd, buf, f->pagesize, off);
+	if (n != f->pagesize) fatal("Can't write page");
+	if (pid >= f->npages) f->npages = pid+1;
+}
+
+// map more of a mapped file, so that all of its size bytes are
+//  mapped; the mapping at least doubles each time, to keep the
+//  number of mmap() calls down as the file grows
+
+static Status growMapping(PageFile f)
+{
+	if (f->size <= f->mapped) return OK;
+	size_t vmpage = sysconf(_SC_PAGESIZE);
+	size_t len = f->writable ? 2*f->mapped : 0;
+	if (len < f->size) len = f->size;
+	len = (len + vmpage-1) / vmpage * vmpage;
+	if (len > MAPRESERVE) len = MAPRESERVE;
+	if (len < f->size) return ~OK;
+	int prot = f->writable ? PROT_READ|PROT_WRITE : PROT_READ;
+	void *p = mmap(f->base + f->mapped, len - f->mapped, prot,
+	               MAP_SHARED|MAP_FIXED, f->fd, f->mapped);
+	if (p == MAP_FAILED) return ~OK;
+	f->mapped = len;
+	return OK;
+}
+
+// write buf as a new page at the end of the file; return its id
+
+PageID appendBlock(PageFile f, Byte *buf)
+{
+	PageID pid = f->npages;
+	writeBlock(f, pid, buf);
+	if (f->base != NULL) {
+		// make the new page visible through the mapping
+		f->size += f->pagesize;
+		if (growMapping(f) != OK) fatal("Can't extend mapping of file");
+	}
+	return pid;
+}
+
+// tell the OS how pages from..from+npages-1 will be used
+// npages == 0 means to the end of the file
+// for mapped files the advice applies to the mapping, so that
+//  e.g. PF_WILLNEED starts faulting pages in before they're used
+// this is only a hint, so failure is ignored
+
+void advisePageFile(PageFile f, PageID from, Offset npages, int advice)
+{
+	static const int fadv[] = {
+		POSIX_FADV_NORMAL, POSIX_FADV_SEQUENTIAL, POSIX_FADV_RANDOM,
+		POSIX_FADV_WILLNEED, POSIX_FADV_DONTNEED
+	};
+	static const int madv[] = {
+		POSIX_MADV_NORMAL, POSIX_MADV_SEQUENTIAL, POSIX_MADV_RANDOM,
+		POSIX_MADV_WILLNEED, POSIX_MADV_DONTNEED
+	};
+	assert(advice >= PF_NORMAL && advice <= PF_DONTNEED);
+	if (f->base != NULL) {
+		// madvise() ranges must start on a VM page boundary
+		size_t lo = (size_t)from*f->pagesize;
+		size_t hi = (npages == 0) ? f->size : lo + (size_t)npages*f->pagesize;
+		if (hi > f->size) hi = f->size;
+		if (lo >= hi) return;
+		size_t vmpage = sysconf(_SC_PAGESIZE);
+		lo -= lo % vmpage;
+		posix_madvise(f->base + lo, hi - lo, madv[advice]);
+		return;
+	}
+	if (f->direct) return;
+	posix_fadvise(f->fd, (off_t)from*f->pagesize,
+	              (off_t)npages*f->pagesize, fadv[advice]);
+}
+
+// access a file's pages through mmap() instead of pread()/pwrite()
+// if writable, changes to pages go directly to the file;
+//  otherwise pages are mapped read-only
+// returns non-OK if the file can't be mapped (caller may carry on
+//  using the buffer pool)
+
+Status mapPageFile(PageFile f, Bool writable)
+{
+	assert(f->base == NULL);
+	void *base = mmap(NULL, MAPRESERVE, PROT_NONE,
+	                  MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+	if (base == MAP_FAILED) return ~OK;
+	f->base = base;
+	f->size = (size_t)f->npages*f->pagesize;
+	f->mapped = 0;
+	f->writable = writable;
+	if (growMapping(f) != OK) {
+		munmap(base, MAPRESERVE);
+		f->base = NULL;
+		f->size = 0;
+		return ~OK;
+	}
+	return OK;
+}
+
+// address of page pid in a mapped file (NULL if not mapped)
+
+Byte *mappedBlock(PageFile f, PageID pid)
+{
+	if (f->base == NULL) return NULL;
+	assert((size_t)(pid+1)*f->pagesize <= f->size);
+	return f->base + (size_t)pid*f->pagesize;
+}
+
+// does buf point into any mapped file?
+
+Bool inMapping(Byte *buf)
+{
+	uintptr_t b = (uintptr_t)buf;
+	for (PageFile f = openFiles; f != NULL; f = f->next) {
+		uintptr_t lo = (uintptr_t)f->base;
+		if (f->base != NULL && b >= lo && b < lo + f->size)
+			return TRUE;
+	}
+	return FALSE;
+}
@@ -0,0 +1,36 @@
+// pagefile.h ... interface to files of fixed-size pages
+// part of Multi-attribute Linear-hashed Files
+// See pagefile.c for details of PageFile type and functions
+
+#ifndef PAGEFILE_H
+#define PAGEFILE_H 1
+
+typedef struct PageFileRep *PageFile;
+
+#include "defs.h"
+
+// flags for openPageFile()
+#define PF_DIRECT     1   // bypass the OS page cache, if possible
+
+// access patterns for advisePageFile()
+#define PF_NORMAL     0
+#define PF_SEQUENTIAL 1
+#define PF_RANDOM     2
+#define PF_WILLNEED   3
+#define PF_DONTNEED   4
+
+PageFile openPageFile(char *name, char *mode, Count pagesize, int flags);
+void closePageFile(PageFile f);
+Count filePageSize(PageFile f);
+int fileDescriptor(PageFile f);
+Offset fileNPages(PageFile f);
+Byte *allocBlock(Count size);
+void readBlock(PageFile f, PageID pid, Byte *buf);
+void writeBlock(PageFile f, PageID pid, Byte *buf);
+PageID appendBlock(PageFile f, Byte *buf);
+void advisePageFile(PageFile f, PageID from, Offset npages, int advice);
+Status mapPageFile(PageFile f, Bool writable);
+Byte *mappedBlock(PageFile f, PageID pid);
+Bool inMapping(Byte *buf);
+
+#endif
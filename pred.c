@@ -0,0 +1,220 @@
+// pred.c ... compiled selection predicates
+// part of Multi-attribute Linear-hashed Files
+// A query tuple (e.g. "1234,?,a%c,?") is compiled once into a
+// list of tests, one per attribute which constrains the match:
+// - a known value is compared in place with memcmp()
+// - a value containing '%' is a LIKE pattern: it is split at
+//   the '%'s into literal segments, which must appear in the
+//   value in order (the first at its start and the last at its
+//   end, unless the pattern begins/ends with '%'); all other
+//   characters match only themselves
+// '?' attributes need no test. Tests are ordered cheapest first
+// (comparisons before pattern matches), and evaluation stops at
+// the first test which fails.
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_SIMD 1     // can build AVX2 code (if the CPU has it)
+#endif
+#include "defs.h"
+#include "pred.h"
+#include "reln.h"
+#include "tuple.h"
+
+// in order of cost
+typedef enum { EQUAL, PATTERN } TestKind;
+
+typedef struct {
+	TestKind kind;  // how to test the attribute
+	int      att;   // which attribute (0-based)
+	char    *val;   // the value, in the query tuple
+	int      len;   //  and its length
+	Count    nsegs; // PATTERN: #literal segments (#'%'s + 1)
+	Field   *segs;  //  the segments, in the query tuple
+} Test;
+
+struct PredRep {
+	Count  ntests; // #attributes which constrain the match
+	Count  nvals;  // #fields of a tuple needed to evaluate tests
+	Test  *tests;  // the tests, cheapest first
+};
+
+// split LIKE pattern qval (len chars) into its segments
+
+static void compilePattern(char *qval, int len, Test *t)
+{
+	t->nsegs = 1;
+	for (int i = 0; i < len; i++)
+		if (qval[i] == '%') t->nsegs++;
+	t->segs = malloc(t->nsegs*sizeof(Field));
+	assert(t->segs != NULL);
+	Count n = 0;
+	char *c0 = qval;
+	for (char *c = qval; c < qval+len; c++) {
+		if (*c != '%') continue;
+		t->segs[n].val = c0;
+		t->segs[n++].len = c - c0;
+		c0 = c+1;
+	}
+	t->segs[n].val = c0;
+	t->segs[n].len = qval+len - c0;
+}
+
+// Substring search
+// Segments are found with a first-and-last-byte filter: compare
+// 32 positions at once against the segment's first byte, and the
+// same 32 positions shifted by len-1 against its last byte; only
+// positions where both match are checked in full. Without AVX2,
+// candidates for the first byte are found with memchr().
+
+// where segment k (klen >= 2 bytes) starts in s (n bytes), or -1
+
+static int findScalar(char *s, int n, char *k, int klen)
+{
+	char *end = s + n - klen + 1;  // last possible start, plus 1
+	for (char *c = s; c < end; c++) {
+		c = memchr(c, k[0], end - c);
+		if (c == NULL) break;
+		if (c[klen-1] == k[klen-1] && memcmp(c+1, k+1, klen-2) == 0)
+			return c - s;
+	}
+	return -1;
+}
+
+#ifdef HAVE_SIMD
+__attribute__((target("avx2")))
+static int findAVX2(char *s, int n, char *k, int klen)
+{
+	__m256i first = _mm256_set1_epi8(k[0]);
+	__m256i last = _mm256_set1_epi8(k[klen-1]);
+	int i;
+	for (i = 0; i + klen-1 + 32 <= n; i += 32) {
+		__m256i f = _mm256_loadu_si256((__m256i *)(s+i));
+		__m256i l = _mm256_loadu_si256((__m256i *)(s+i+klen-1));
+		unsigned m = _mm256_movemask_epi8(_mm256_and_si256(
+		                 _mm256_cmpeq_epi8(f, first), _mm256_cmpeq_epi8(l, last)));
+		for (; m != 0; m &= m-1) {
+			int j = i + __builtin_ctz(m);
+			if (memcmp(s+j+1, k+1, klen-2) == 0) return j;
+		}
+	}
+	int j = findScalar(s+i, n-i, k, klen);
+	return (j < 0) ? -1 : i+j;
+}
+#endif
+
+static Bool useAVX2 = FALSE;  // set by compilePred()
+
+// where segment k (klen bytes) first starts in s (n bytes), or -1
+
+static int findSegment(char *s, int n, char *k, int klen)
+{
+	if (klen == 0) return 0;
+	if (klen > n) return -1;
+	if (klen == 1) {
+		char *c = memchr(s, k[0], n);
+		return (c == NULL) ? -1 : c - s;
+	}
+#ifdef HAVE_SIMD
+	if (useAVX2) return findAVX2(s, n, k, klen);
+#endif
+	return findScalar(s, n, k, klen);
+}
+
+// does value v (n bytes) match LIKE pattern t?
+// taking the leftmost place for each middle segment never
+//  rules out a match, so no backtracking is needed
+
+static Bool matchPattern(Test *t, char *v, int n)
+{
+	Field *first = &t->segs[0], *last = &t->segs[t->nsegs-1];
+	if (first->len + last->len > n) return FALSE;
+	if (memcmp(v, first->val, first->len) != 0) return FALSE;
+	if (memcmp(v+n-last->len, last->val, last->len) != 0) return FALSE;
+	char *c = v + first->len, *end = v + n - last->len;
+	for (Count i = 1; i < t->nsegs-1; i++) {
+		Field *seg = &t->segs[i];
+		int j = findSegment(c, end - c, seg->val, seg->len);
+		if (j < 0) return FALSE;
+		c += j + seg->len;
+	}
+	return TRUE;
+}
+
+// order tests by cost, then by attribute
+
+static int cmpTest(const void *a, const void *b)
+{
+	const Test *x = a, *y = b;
+	if (x->kind != y->kind) return (int)x->kind - (int)y->kind;
+	return x->att - y->att;
+}
+
+// compile query tuple q for relation r
+// q must stay unchanged while the Pred is in use
+
+Pred compilePred(Reln r, Tuple q)
+{
+	Pred new = malloc(sizeof(struct PredRep));
+	assert(new != NULL);
+#ifdef HAVE_SIMD
+	useAVX2 = __builtin_cpu_supports("avx2") != 0;
+#endif
+	Count na = nattrs(r);
+	Field qvals[na];
+	tupleFields(q, qvals, na);
+	new->tests = malloc(na*sizeof(Test));
+	assert(new->tests != NULL);
+	new->ntests = 0;
+	new->nvals = 0;
+	for (int i = 0; i < na; i++) {
+		char *qval = qvals[i].val;
+		int len = qvals[i].len;
+		if (memchr(qval, '?', len)) continue;
+		Test *t = &new->tests[new->ntests++];
+		t->att = i;
+		t->val = qval;
+		t->len = len;
+		t->kind = memchr(qval, '%', len) ? PATTERN : EQUAL;
+		if (t->kind == PATTERN) compilePattern(qval, len, t);
+		new->nvals = i+1;
+	}
+	qsort(new->tests, new->ntests, sizeof(Test), cmpTest);
+	return new;
+}
+
+// does tuple t satisfy p?
+
+Bool evalPred(Pred p, Tuple t)
+{
+	if (p->ntests == 0) return TRUE;
+	Field vals[p->nvals];
+	tupleFields(t, vals, p->nvals);
+	for (Count i = 0; i < p->ntests; i++) {
+		Test *test = &p->tests[i];
+		Field *f = &vals[test->att];
+		switch (test->kind) {
+		case EQUAL:
+			if (f->len != test->len || memcmp(f->val, test->val, f->len) != 0)
+				return FALSE;
+			break;
+		case PATTERN:
+			if (!matchPattern(test, f->val, f->len))
+				return FALSE;
+			break;
+		}
+	}
+	return TRUE;
+}
+
+// release a compiled predicate
+
+void freePred(Pred p)
+{
+	if (p == NULL) return;
+	for (Count i = 0; i < p->ntests; i++) {
+		if (p->tests[i].kind == PATTERN) free(p->tests[i].segs);
+	}
+	free(p->tests);
+	free(p);
+}
@@ -0,0 +1,17 @@
+// pred.h ... interface to compiled selection predicates
+// part of Multi-attribute Linear-hashed Files
+// See pred.c for details of Pred type and functions
+
+#ifndef PRED_H
+#define PRED_H 1
+
+typedef struct PredRep *Pred;
+
+#include "reln.h"
+#include "tuple.h"
+
+Pred compilePred(Reln r, Tuple q);
+Bool evalPred(Pred p, Tuple t);
+void freePred(Pred p);
+
+#endif
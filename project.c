@@ -30,6 +30,7 @@ Projection startProjection(Reln r, char *attrstr)
     //TODO
     new->rel = r;
     new->attrstr = copyString(attrstr);
+    new->attrsOrder = NULL;
     // if attrstr first char is *, means select all
     if (new->attrstr[0] == '*') {
         new->nattrs = 0;
@@ -59,10 +60,9 @@ Projection startProjection(Reln r, char *attrstr)
 
 void projectTuple(Projection p, Tuple t, char *buf)
 {
-    // TODO: Implement projection of tuple 't' according to 'p' and store result in 'buf'
 	Count na = nattrs(p->rel);
-	char **tupArray = malloc(na*sizeof(char *));
-	tupleVals(t, tupArray);
+	Field tupArray[na];
+	tupleFields(t, tupArray, na);
 
     // return the whole tuple if attrstr is '*'
     // else, form the result from attrsOrder
@@ -70,24 +70,15 @@ void projectTuple(Projection p, Tuple t, char *buf)
         tupleString(t, buf);
     }
     else {
-        int result_size = p->nattrs-1;
+        char *c = buf;
         for (int i = 0; i < p->nattrs; i++) {
-            int attr_idx = p->attrsOrder[i]-1;
-            result_size += strlen(tupArray[attr_idx]);
+            Field f = tupArray[p->attrsOrder[i]-1];
+            memcpy(c, f.val, f.len);
+            c += f.len;
+            if (i < p->nattrs - 1) *c++ = ',';
         }
-        char result[result_size];
-        memset(result, 0, result_size);
-        for (int i = 0; i < p->nattrs; i++) {
-            int attr_idx = p->attrsOrder[i]-1;
-            strcat(result, tupArray[attr_idx]);
-            if (i < p->nattrs - 1) {
-                strcat(result, ",");
-            }
-        }
-        tupleString(result, buf);
-
+        *c = '\0';
     }
-    freeVals(tupArray,na);
 }
 
 void closeProjection(Projection p)
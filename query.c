@@ -1,10 +1,14 @@
 // query.c ... run queries
 // part of Multi-attribute linear-hashed files
 // Ask a query on a named relation
-// Usage:  ./query  [-v]  'a1,a3,..'  from  RelName where 'v1,v2,v3,v4,...'
+// Usage:  ./query  [-v]  [-B #buffers]  [-p #prefetch]  'a1,a3,..'  from  RelName where 'v1,v2,v3,v4,...'
 // - a1,a3,... can be '*' to indicate all attributes
 // - Any vi can be '?' to indicate an unknown value
 // - Any vi can contain '%' as a wildcard matching zero or more characters
+// -v shows how the tuples will be found (see showSelectionPlan())
+// -B sets the #frames in the buffer pool (default NBUFFERS)
+// -p sets the #pages read ahead of the scan (default PREFETCH;
+//    0 turns prefetching off)
 // Credit: John Shepherd
 // Last modified by Xiangjun Zai, Mar 2025
 
@@ -14,8 +18,9 @@
 #include "tuple.h"
 #include "reln.h"
 #include "chvec.h"
+#include "buffer.h"
 
-#define USAGE "./query  [-v]  a1,a3,..(*)  from  RelName  where  v1,v2,v3,v4,..."
+#define USAGE "./query  [-v]  [-B #buffers]  [-p #prefetch]  a1,a3,..(*)  from  RelName  where  v1,v2,v3,v4,..."
 
 // Main ... process args, run query
 
@@ -26,24 +31,37 @@ int main(int argc, char **argv)
 	Projection p;  // handle on the projection
 	Tuple t;  // tuple pointer
 	char err[MAXERRMSG];  // buffer for error messages
-	int offset = 0; // adapt offset for -v
 	int verbose = 0;  // show extra info on query progress
+	int nbuffers = NBUFFERS;  // #frames in buffer pool
+	int prefetch = PREFETCH;  // #pages to read ahead
 	char *rname;  // name of table/file
 	char *valstr;   // a query string of values for selection
 	char *attrstr;   // string of 1-based attribute indexes used for projection
 
 	// process command-line args
 
-	if (argc < 6 || argc > 7) fatal(USAGE);
-	if (strcmp(argv[1], "-v") == 0) {
-		if (argc != 7) fatal(USAGE);
-		offset = 1;  verbose = 1;
+	int a;
+	for (a = 1; a < argc && argv[a][0] == '-'; a++) {
+		if (strcmp(argv[a], "-v") == 0)
+			verbose = 1;
+		else if (strcmp(argv[a], "-B") == 0 && a+1 < argc) {
+			nbuffers = atoi(argv[++a]);
+			if (nbuffers < MINBUFFERS) fatal(USAGE);
+		}
+		else if (strcmp(argv[a], "-p") == 0 && a+1 < argc) {
+			prefetch = atoi(argv[++a]);
+			if (prefetch < 0) fatal(USAGE);
+		}
+		else
+			fatal(USAGE);
 	}
-	if (strcmp(argv[offset+2], "from") != 0 || strcmp(argv[offset+4], "where") != 0) {
+	if (argc - a != 5) fatal(USAGE);
+	if (strcmp(argv[a+1], "from") != 0 || strcmp(argv[a+3], "where") != 0) {
         fatal(USAGE);
     }
-	attrstr = argv[offset+1];  rname = argv[offset+3];  valstr = argv[offset+5];
-	if (verbose) { /* keeps compiler quiet */ }
+	attrstr = argv[a];  rname = argv[a+2];  valstr = argv[a+4];
+	initBufferPool(nbuffers);
+	setPrefetchDepth(prefetch);
 
 	// initialise relation, scanning, projection structure
 
@@ -51,7 +69,7 @@ int main(int argc, char **argv)
 		sprintf(err, "No such relation: %s",rname);
 		fatal(err);
 	}
-	if ((r = openRelation(rname,"r")) == NULL) {
+	if ((r = openRelation(rname,"rm")) == NULL) {
 		sprintf(err, "Can't open relation: %s",rname);
 		fatal(err);
 	}
@@ -59,6 +77,7 @@ int main(int argc, char **argv)
 		sprintf(err, "Invalid selection: %s",valstr);
 		fatal(err);
 	}
+	if (verbose) showSelectionPlan(s);
 	if ((p = startProjection(r, attrstr)) == NULL) {	
 		sprintf(err, "Invalid projection: %s",attrstr);
 		fatal(err);
@@ -10,46 +10,349 @@
 #include "chvec.h"
 #include "bits.h"
 #include "hash.h"
+#include "buffer.h"
+#include "ngram.h"
 
 #define HEADERSIZE (3*sizeof(Count)+sizeof(Offset))
 
+// .info file layout
+// format 10: INFOMAGIC, INFOFORMAT, then a Count for each of
+//   nattrs, depth, an Offset for sp, a Count for each of
+//   npages, ntups, pagecap, curcap, pagesize, loadfactor, an
+//   Offset for nbytes, a Count for each of expansions, phase,
+//   hashfn, ngramatt, ngramsync and nfree, an Offset for fsmbits,
+//   then the choice vector, followed by the free space map for
+//   the ovflow file (fsmbits bits)
+// format 9: as for format 10, without ngramsync (i.e. the index
+//   is taken to be in sync)
+// format 8: as for format 9, without ngramatt (i.e. no index)
+// format 7: as for format 8, without hashfn (i.e. HASH_PG)
+// format 6: as for format 7, without expansions and phase
+//   (i.e. ordinary linear hashing)
+// format 5: as for format 6, without loadfactor and nbytes
+//   (i.e. splits every pagecap insertions)
+// format 4: as for format 5, but instead of nfree and the free
+//   space map, an Offset for the head of a free list (linked
+//   through the pages' ovflow fields) and a Count for nfree
+// format 3: as for format 4, without the free list
+// format 2: as for format 3, but sp is a Count
+// format 1 (no magic): nattrs, depth, sp, npages, ntups, pagecap,
+//   curcap and the choice vector; pages are PAGESIZE bytes
+// older formats are rewritten as INFOFORMAT when the relation
+//   is next opened for writing
+#define INFOMAGIC  0x4d414849
+#define INFOFORMAT 10
+
+// #overflow pages added to the end of the file at a time
+#define OVEXTENT 4
+
+// #hash bits used to choose among a group of buckets whose size
+//  is not a power of 2 (see groupIndex())
+#define XBITS 8
+#define XMASK ((1 << XBITS) - 1)
+
+static void finishSplit(Reln r);
+
 struct RelnRep {
 	Count  nattrs; // number of attributes
-	Count  depth;  // depth of main data file
-	Offset sp;     // split pointer
+	Count  depth;  // depth of main data file (2^depth bucket groups)
+	Offset sp;     // split pointer (next group to expand)
     Count  npages; // number of main data pages
     Count  ntups;  // total number of tuples
 	Count  pagecap;// split after c insertion 
 	Count  curcap; // number of insertion
+	Count  pagesize; // #bytes in each data/ovflow page
+	Count  loadfactor; // target % full for primary pages (0 = use pagecap)
+	Offset nbytes; // #bytes of page space used by tuples
+	Count  expansions; // #partial expansions per doubling (1 = plain)
+	Count  phase;  // partial expansion in progress (0..expansions-1)
+	Count  hashfn; // hash function for attribute values (see hash.h)
+	Count  ngramatt;// attribute with a trigram index, plus 1 (0 if none)
+	Bool   ngramsync;// does the .ngram file match the data files?
+	NgramIndex ngram;// the trigram index (not in .info)
+	Count  nfree;  // number of free pages in ovflow file
+	Offset fsmbits;// number of ovflow pages covered by fsm
+	Byte  *fsm;    // free space map: bit set if ovflow page is free
 	ChVec  cv;     // choice vector
+	ChVecPlan plan;// cv compiled for tupleHash() (not in .info)
+
+	// incremental splitting (see splitStep())
+	Bool   incremental; // spread splits over later inserts?
+	Bool   pending;// is a group half-split?
+	PageID pgroup; // the half-split group, as it was before the split:
+	Count  pdepth; //  its group number, the depth,
+	Count  psize;  //  and its #buckets
+	Count  pbucket;// bucket (index in group) being drained
+	PageID ppid;   // next page to drain in its chain
+	PageID pprev;  // page before ppid (NO_PAGE if ppid is primary)
+	Bool   pprimary;// is pprev the primary page?
+	Bool   pshrunk;// have tuples moved out of bucket pbucket?
 
+	char  *name;   // name of relation (NULL while being created)
 	char   mode;   // open for read/write
 	FILE  *info;   // handle on info file
-	FILE  *data;   // handle on data file
-	FILE  *ovflow; // handle on ovflow file
+	PageFile data; // handle on data file
+	PageFile ovflow; // handle on ovflow file
 };
 
+static Count getCount(FILE *f)
+{
+	Count c;
+	int n = fread(&c, sizeof(Count), 1, f);
+	assert(n == 1);
+	return c;
+}
+
+static void putCount(FILE *f, Count c)
+{
+	int n = fwrite(&c, sizeof(Count), 1, f);
+	assert(n == 1);
+}
+
+static Offset getOffset(FILE *f)
+{
+	Offset o;
+	int n = fread(&o, sizeof(Offset), 1, f);
+	assert(n == 1);
+	return o;
+}
+
+static void putOffset(FILE *f, Offset o)
+{
+	int n = fwrite(&o, sizeof(Offset), 1, f);
+	assert(n == 1);
+}
+
+// read global relation info from .info file
+// handles all formats up to INFOFORMAT
+// for format 4, *freeov is set to the head of the free list,
+//  which the caller converts to a free space map
+
+static void readInfo(Reln r, Offset *freeov)
+{
+	Count format = 1;
+	Count c = getCount(r->info);
+	if (c == INFOMAGIC) {
+		format = getCount(r->info);
+		if (format > INFOFORMAT) fatal("Relation has unknown .info format");
+		c = getCount(r->info);
+	}
+	r->nattrs = c;
+	r->depth = getCount(r->info);
+	r->sp = (format >= 3) ? getOffset(r->info) : getCount(r->info);
+	r->npages = getCount(r->info);
+	r->ntups = getCount(r->info);
+	r->pagecap = getCount(r->info);
+	r->curcap = getCount(r->info);
+	r->pagesize = (format >= 2) ? getCount(r->info) : PAGESIZE;
+	r->loadfactor = (format >= 6) ? getCount(r->info) : 0;
+	r->nbytes = (format >= 6) ? getOffset(r->info) : 0;
+	r->expansions = (format >= 7) ? getCount(r->info) : 1;
+	r->phase = (format >= 7) ? getCount(r->info) : 0;
+	r->hashfn = (format >= 8) ? getCount(r->info) : HASH_PG;
+	if (r->hashfn >= NHASHES) fatal("Relation has unknown hash function");
+	r->ngramatt = (format >= 9) ? getCount(r->info) : 0;
+	r->ngramsync = (format >= 10) ? getCount(r->info) : TRUE;
+	*freeov = NO_PAGE;
+	r->nfree = 0;
+	r->fsmbits = 0;
+	if (format == 4) {
+		*freeov = getOffset(r->info);
+		r->nfree = getCount(r->info);
+	}
+	else if (format >= 5) {
+		r->nfree = getCount(r->info);
+		r->fsmbits = getOffset(r->info);
+	}
+	int n = fread(r->cv, sizeof(ChVecItem), MAXCHVEC, r->info);
+	assert(n == MAXCHVEC);
+	size_t nbytes = (r->fsmbits+7)/8;
+	r->fsm = calloc(nbytes+1, 1);
+	assert(r->fsm != NULL);
+	n = fread(r->fsm, 1, nbytes, r->info);
+	assert(n == nbytes);
+}
+
+// write global relation info to .info file (always INFOFORMAT)
+
+static void writeInfo(Reln r)
+{
+	fseek(r->info, 0, SEEK_SET);
+	putCount(r->info, INFOMAGIC);
+	putCount(r->info, INFOFORMAT);
+	putCount(r->info, r->nattrs);
+	putCount(r->info, r->depth);
+	putOffset(r->info, r->sp);
+	putCount(r->info, r->npages);
+	putCount(r->info, r->ntups);
+	putCount(r->info, r->pagecap);
+	putCount(r->info, r->curcap);
+	putCount(r->info, r->pagesize);
+	putCount(r->info, r->loadfactor);
+	putOffset(r->info, r->nbytes);
+	putCount(r->info, r->expansions);
+	putCount(r->info, r->phase);
+	putCount(r->info, r->hashfn);
+	putCount(r->info, r->ngramatt);
+	putCount(r->info, r->ngramsync);
+	putCount(r->info, r->nfree);
+	putOffset(r->info, r->fsmbits);
+	int n = fwrite(r->cv, sizeof(ChVecItem), MAXCHVEC, r->info);
+	assert(n == MAXCHVEC);
+	size_t nbytes = (r->fsmbits+7)/8;
+	if (nbytes > 0) {
+		n = fwrite(r->fsm, 1, nbytes, r->info);
+		assert(n == nbytes);
+	}
+}
+
+// Free space in the ovflow file
+// Overflow pages which are no longer in any bucket's chain are
+// marked in the free space map, and reused before the file is
+// extended. Pages are allocated so that chains stay physically
+// contiguous where possible:
+// - a chain grows into the page just after its last page, if
+//   that page is free
+// - otherwise the new page starts a run of OVEXTENT free pages,
+//   leaving the rest of the run for the chain to grow into
+// - otherwise a free page is used which isn't just after a page
+//   in use, as that one is held for the chain through the page
+//   in use to grow into
+// - the file is extended OVEXTENT pages at a time
+// Once free pages are plentiful but scattered, any free page is
+// used, which keeps the size of the file bounded
+
+static Bool isFree(Reln r, PageID pid)
+{
+	return pid < r->fsmbits && (r->fsm[pid/8] & (1 << (pid%8)));
+}
+
+static void setFree(Reln r, PageID pid, Bool free)
+{
+	if (pid >= r->fsmbits) {
+		Offset nbits = r->fsmbits;
+		while (nbits <= pid) nbits = (nbits == 0) ? 64 : 2*nbits;
+		r->fsm = realloc(r->fsm, (nbits+7)/8);
+		assert(r->fsm != NULL);
+		memset(r->fsm + (r->fsmbits+7)/8, 0, (nbits+7)/8 - (r->fsmbits+7)/8);
+		r->fsmbits = nbits;
+	}
+	if (free)
+		r->fsm[pid/8] |= 1 << (pid%8);
+	else
+		r->fsm[pid/8] &= ~(1 << (pid%8));
+}
+
+// set up the free space map from a format 4 free list
+
+static void loadFreeList(Reln r, PageID pid)
+{
+	while (pid != NO_PAGE) {
+		setFree(r, pid, TRUE);
+		Page pg = getPage(r->ovflow, pid);
+		pid = pageOvflow(pg);
+		releasePage(pg);
+	}
+}
+
+// find the first of n consecutive free pages (NO_PAGE if none)
+
+static PageID freeRun(Reln r, Count n)
+{
+	Count run = 0;
+	for (PageID pid = 0; pid < r->fsmbits; pid++) {
+		if (r->fsm[pid/8] == 0) {
+			// skip a byte's worth of allocated pages
+			pid |= 7;
+			run = 0;
+			continue;
+		}
+		run = isFree(r, pid) ? run+1 : 0;
+		if (run == n) return pid+1-n;
+	}
+	return NO_PAGE;
+}
+
+// find a free page which no chain will grow into, i.e. one not
+//  just after a page in use (NO_PAGE if none)
+
+static PageID freeUnheld(Reln r)
+{
+	if (isFree(r, 0)) return 0;
+	PageID pid = freeRun(r, 2);
+	return (pid == NO_PAGE) ? NO_PAGE : pid+1;
+}
+
+// get an empty overflow page for a chain whose last page is
+//  prev (NO_PAGE if the chain has no overflow pages yet)
+
+static PageID newOvflowPage(Reln r, PageID prev)
+{
+	PageID pid = NO_PAGE;
+	if (r->nfree > 0) {
+		if (prev != NO_PAGE && isFree(r, prev+1))
+			pid = prev+1;
+		else
+			pid = freeRun(r, OVEXTENT);
+		if (pid == NO_PAGE)
+			pid = freeUnheld(r);
+		if (pid == NO_PAGE && r->nfree*4 >= fileNPages(r->ovflow))
+			pid = freeRun(r, 1);
+	}
+	if (pid == NO_PAGE) {
+		pid = addPage(r->ovflow);
+		for (Count i = 1; i < OVEXTENT; i++) {
+			PageID ext = addPage(r->ovflow);
+			setFree(r, ext, TRUE);
+			r->nfree++;
+		}
+		return pid;
+	}
+	setFree(r, pid, FALSE);
+	r->nfree--;
+	putPage(r->ovflow, pid, newPage(r->pagesize));
+	return pid;
+}
+
+// mark an overflow page, no longer in any chain, as free
+
+static void freeOvflowPage(Reln r, PageID pid)
+{
+	setFree(r, pid, TRUE);
+	r->nfree++;
+}
+
 // create a new relation (three files)
 
-Status newRelation(char *name, Count nattrs, Count npages, Count d, char *cv)
+Status newRelation(char *name, Count nattrs, Count npages, Count d, char *cv,
+                   Count pagesize, Count loadfactor, Count expansions,
+                   Count hashfn)
 {
     char fname[MAXFILENAME];
 	Reln r = malloc(sizeof(struct RelnRep));
+	assert(r != NULL);
 	r->nattrs = nattrs; r->depth = d; r->sp = 0; 
-	r->pagecap = 1024/(10*nattrs); 
+	r->pagesize = pagesize;
+	r->pagecap = pagesize/(10*nattrs); 
 	r->curcap = 0;
+	r->loadfactor = loadfactor; r->nbytes = 0;
+	r->expansions = expansions; r->phase = 0;
+	r->hashfn = hashfn;
+	r->ngramatt = 0; r->ngramsync = TRUE; r->ngram = NULL; r->name = NULL;
+	assert(npages == expansions << d);
 	r->npages = npages; r->ntups = 0; r->mode = 'w';
-	assert(r != NULL);
+	r->nfree = 0; r->fsmbits = 0; r->fsm = NULL;
+	r->incremental = FALSE; r->pending = FALSE; r->plan = NULL;
 	// store att and bit value into r->cv
 	if (parseChVec(r, cv, r->cv) != OK) return ~OK;
 	sprintf(fname,"%s.info",name);
 	r->info = fopen(fname,"w");
 	assert(r->info != NULL);
 	sprintf(fname,"%s.data",name);
-	r->data = fopen(fname,"w");
+	r->data = openPageFile(fname,"w",r->pagesize,0);
 	assert(r->data != NULL);
 	sprintf(fname,"%s.ovflow",name);
-	r->ovflow = fopen(fname,"w");
+	r->ovflow = openPageFile(fname,"w",r->pagesize,0);
 	assert(r->ovflow != NULL);
 	int i;
 	for (i = 0; i < npages; i++) addPage(r->data);
@@ -74,28 +377,65 @@ Bool existsRelation(char *name)
 
 // set up a relation descriptor from relation name
 // open files, reads information from rel.info
+// mode is as for fopen(), plus optional flags
+//  'm' to access the data and overflow pages via mmap() rather
+//      than the buffer pool
+//  'd' to read and write pages with O_DIRECT, bypassing the OS
+//      page cache (the buffer pool does all caching)
+//  'i' to split buckets incrementally (see splitStep())
 
 Reln openRelation(char *name, char *mode)
 {
 	Reln r;
 	r = malloc(sizeof(struct RelnRep));
 	assert(r != NULL);
+	char fmode[4]; int i = 0;
+	for (char *c = mode; *c != '\0' && i < 3; c++)
+		if (*c != 'm' && *c != 'd' && *c != 'i') fmode[i++] = *c;
+	fmode[i] = '\0';
 	char fname[MAXFILENAME];
 	sprintf(fname,"%s.info",name);
-	r->info = fopen(fname,mode);
+	r->info = fopen(fname,fmode);
 	assert(r->info != NULL);
+	Offset freeov;
+	readInfo(r, &freeov);
+	r->plan = compileChVec(r->cv, r->nattrs);
+	r->name = copyString(name);
+	r->mode = (fmode[0] == 'w' || fmode[1] =='+') ? 'w' : 'r';
+	// the trigram index is out of sync if a session which updated
+	//  the relation didn't close it; it is ignored (and so is no
+	//  longer kept up to date) until rebuilt (see indexRelation())
+	// while open for writing, the index is marked out of sync
+	//  until closeRelation() has saved it and the data files
+	r->ngram = NULL;
+	if (r->ngramatt > 0 && !r->ngramsync)
+		warning("Relation's trigram index is out of date; rebuild it with ./index");
+	else if (r->ngramatt > 0) {
+		r->ngram = loadNgramIndex(name);
+		if (r->ngram == NULL) fatal("Relation's .ngram file is missing");
+		if (r->mode == 'w') {
+			r->ngramsync = FALSE;
+			writeInfo(r);
+			fflush(r->info);
+		}
+	}
+	int flags = (strchr(mode,'d') != NULL) ? PF_DIRECT : 0;
 	sprintf(fname,"%s.data",name);
-	r->data = fopen(fname,mode);
+	r->data = openPageFile(fname,fmode,r->pagesize,flags);
 	assert(r->data != NULL);
 	sprintf(fname,"%s.ovflow",name);
-	r->ovflow = fopen(fname,mode);
+	r->ovflow = openPageFile(fname,fmode,r->pagesize,flags);
 	assert(r->ovflow != NULL);
-	// Naughty: assumes Count and Offset are the same size
-	int n = fread(r, sizeof(Count), 7, r->info);
-	assert(n == 7);
-	n = fread(r->cv, sizeof(ChVecItem), MAXCHVEC, r->info);
-	assert(n == MAXCHVEC);
-	r->mode = (mode[0] == 'w' || mode[1] =='+') ? 'w' : 'r';
+	if (freeov != NO_PAGE) loadFreeList(r, freeov);
+	r->incremental = (strchr(mode,'i') != NULL);
+	r->pending = FALSE;
+	// fall back to the buffer pool if the files can't be mapped
+	if (strchr(mode,'m') != NULL) {
+		if (mapPageFile(r->data, r->mode == 'w') != OK)
+			warning("Can't map .data file; using the buffer pool");
+		if (mapPageFile(r->ovflow, r->mode == 'w') != OK)
+			warning("Can't map .ovflow file; using the buffer pool");
+	}
 	return r;
 }
 
@@ -105,147 +445,611 @@ Reln openRelation(char *name, char *mode)
 void closeRelation(Reln r)
 {
 	// make sure updated global data is put in info
-	// Naughty: assumes Count and Offset are the same size
+	// a half-split group is finished first, so the files on disk
+	//  never hold one
+	// the trigram index is only marked in sync once it and the
+	//  data files are all written
+	finishSplit(r);
+	if (r->ngram != NULL && r->mode == 'w') saveNgramIndex(r->ngram);
+	flushBuffers(r->data);
+	flushBuffers(r->ovflow);
 	if (r->mode == 'w') {
-		fseek(r->info, 0, SEEK_SET);
-		// write out core relation info (#attr,#pages,d,sp)
-		int n = fwrite(r, sizeof(Count), 7, r->info);
-		assert(n == 7);
-		// write out choice vector
-		n = fwrite(r->cv, sizeof(ChVecItem), MAXCHVEC, r->info);
-		assert(n == MAXCHVEC);
+		if (r->ngram != NULL) r->ngramsync = TRUE;
+		writeInfo(r);
 	}
 	fclose(r->info);
-	fclose(r->data);
-	fclose(r->ovflow);
+	closePageFile(r->data);
+	closePageFile(r->ovflow);
+	free(r->fsm);
+	if (r->plan != NULL) freeChVecPlan(r->plan);
+	freeNgramIndex(r->ngram);
+	free(r->name);
 	free(r);
 }
 
-// splitting function to split current page into two
-void splitting(Reln r)
+// insert tuples ts[0..n-1], whose hash values are hs[0..n-1] and
+//  which all belong to bucket p, in one pass along the bucket's chain
+// each page takes whichever of the remaining tuples fit in it,
+//  so every page in the chain is read, and written, at most once
+// new overflow pages are added at the end of the chain as needed
+// returns the number of tuples inserted (less than n only if a
+//  tuple won't fit even in an empty page)
+// if failed is not NULL, failed[i] is set if ts[i] wasn't inserted
+
+static Count insertBatchIntoBucket(Reln r, PageID p, Tuple *ts, Bits *hs, Count n,
+                                   Bool *failed)
 {
-	// add one page at the end of Reln r
-	r->npages++;
-	addPage(dataFile(r));
+	// indexes in ts[] of tuples not yet inserted
+	// (on the stack for small batches, e.g. single inserts)
+	Count local[16];
+	Count *left = (n <= 16) ? local : malloc(n*sizeof(Count));
+	assert(left != NULL);
+	for (Count i = 0; i < n; i++) left[i] = i;
+	Count nleft = n;
+	PageFile f = r->data;
+	PageID pid = p;
+	Bool fresh = FALSE;  // is pid a newly added (empty) page?
+	for (;;) {
+		Page pg = getPage(f, pid);
+		Count keep = 0;
+		for (Count i = 0; i < nleft; i++) {
+			if (addToPage(pg, ts[left[i]], hs[left[i]]) != OK)
+				left[keep++] = left[i];
+		}
+		Bool dirty = (keep < nleft);
+		if (f == r->data && keep > 0) {
+			// the primary page's filter covers the whole chain
+			for (Count i = 0; i < keep; i++)
+				pageFilterTuple(pg, ts[left[i]]);
+			dirty = TRUE;
+		}
+		if (fresh && !dirty) {
+			// can't add to a new page; we have a problem
+			releasePage(pg);
+			break;
+		}
+		nleft = keep;
+		PageID next = pageOvflow(pg);
+		fresh = FALSE;
+		if (nleft > 0 && next == NO_PAGE) {
+			// all pages in chain are full; add another to chain
+			next = newOvflowPage(r, (f == r->ovflow) ? pid : NO_PAGE);
+			pageSetOvflow(pg, next);
+			dirty = TRUE;
+			fresh = TRUE;
+		}
+		if (dirty)
+			putPage(f, pid, pg);
+		else
+			releasePage(pg);
+		if (nleft == 0) break;
+		f = r->ovflow;
+		pid = next;
+	}
+	if (r->ngram != NULL) {
+		for (Count i = 0; i < n; i++) ngramAddTuple(r->ngram, p, ts[i]);
+	}
+	if (failed != NULL) {
+		for (Count i = 0; i < n; i++) failed[i] = FALSE;
+		for (Count i = 0; i < nleft; i++) failed[left[i]] = TRUE;
+	}
+	if (left != local) free(left);
+	return n - nleft;
+}
 
-	// rearrange tuple into old and new page
-	// create a temp page to store old page data
-	PageID oldpId = r->sp;
-	Page tmpPage = getPage(r->data,oldpId);
-	Tuple tmpTuple = pageData(tmpPage);
-	Page oldPage = newPage();
-	pageSetOvflow(oldPage, pageOvflow(getPage(r->data, oldpId)));
-	putPage(r->data, oldpId, oldPage);
+// insert a tuple, with hash value h, into the chain of pages for
+//  bucket p
+// tries the primary data page first, then each overflow page,
+//  and finally adds a new overflow page at the end of the chain
+// returns p if inserted, NO_PAGE if insert fails completely
 
-	Bits h, p;
-	Count scannedTup = 0;
-
-	// scan through current data page
-	// the number of Tuple in current page should not require an overflow page
-	// there is always enough space to store the tuple in current page
-	while (scannedTup != pageNTuples(tmpPage)) {
-		h = tupleHash(r,tmpTuple);
-		// should always consider depth + 1 bits in splitting
-		p = getLower(h, r->depth+1);
-		Page pg = getPage(r->data,p);
-		if (addToPage(pg,tmpTuple) == OK) {
-			putPage(r->data,p,pg);
-		}
-		tmpTuple = tmpTuple + tupLength(tmpTuple) + 1;
-		scannedTup++;
-	}
-
-	// scan through overflow page
-	while (pageOvflow(tmpPage) != NO_PAGE) {
-		PageID ovpId = pageOvflow(tmpPage);
-		tmpPage = getPage(r->ovflow, ovpId);
-		tmpTuple = pageData(tmpPage);
-
-		oldPage = newPage();
-		pageSetOvflow(oldPage, pageOvflow(getPage(r->ovflow, ovpId)));
-		putPage(r->ovflow, ovpId, oldPage);
-
-		scannedTup = 0;
-		// scan through tuple
-		while (scannedTup != pageNTuples(tmpPage)) {
-			h = tupleHash(r,tmpTuple);
-			p = getLower(h, r->depth+1);
-			Page pg = getPage(r->data,p);
-
-			// insertion to data page
-			if (addToPage(pg,tmpTuple) == OK) {
-				putPage(r->data,p,pg);
-				scannedTup++;
-				tmpTuple = tmpTuple + tupLength(tmpTuple) + 1;
-				continue;
-			}
+static PageID insertIntoBucket(Reln r, PageID p, Tuple t, Bits h)
+{
+	return (insertBatchIntoBucket(r, p, &t, &h, 1, NULL) == 1) ? p : NO_PAGE;
+}
 
-			// create an overflow page if there is no space for current tuple
-			// insert to overflow page afterward
-			if (pageOvflow(pg) == NO_PAGE) {
-				// add first overflow page in chain
-				PageID newp = addPage(r->ovflow);
-				pageSetOvflow(pg,newp);
-				putPage(r->data,p,pg);
-				Page newpg = getPage(r->ovflow,newp);
-				if (addToPage(newpg,tmpTuple) == OK) {
-					putPage(r->ovflow,newp,newpg);
-					scannedTup++;
-					tmpTuple = tmpTuple + tupLength(tmpTuple) + 1;
-					continue;
-				}
-			}
+// hash value of tuple k in page p
+// taken from the page where it's stored there; pages written
+//  before hashes were stored need the tuple to be hashed
 
-			// find space to insert in overflow pages
-			Page ovpg, prevpg = NULL;
-			PageID ovp, prevp = NO_PAGE;
-			ovp = pageOvflow(pg);
-			free(pg);
-			
-			int inserted = 0;
-			while (ovp != NO_PAGE) {
-				ovpg = getPage(r->ovflow, ovp);
-				if (addToPage(ovpg, tmpTuple) != OK) {
-					if (prevpg != NULL) free(prevpg);
-					prevp = ovp; prevpg = ovpg;
-					ovp = pageOvflow(ovpg);
-				} else {
-					if (prevpg != NULL) free(prevpg);
-					putPage(r->ovflow,ovp,ovpg);
-					scannedTup++;
-					tmpTuple = tmpTuple + tupLength(tmpTuple) + 1;
-					inserted = 1;
-					break;
-				}
-			}
+static Bits hashOf(Reln r, Page p, Count k)
+{
+	if (pageHasHashes(p)) return pageTupleHash(p, k);
+	return tupleHash(r, pageTuple(p, k));
+}
 
-			// create a new overflow page if all overflow pages are full
-			// insert to the new overflow page
-			if (!inserted) {
-				assert(prevpg != NULL);
-				// make new ovflow page
-				PageID newp = addPage(r->ovflow);
-				// insert tuple into new page
-				Page newpg = getPage(r->ovflow,newp);
-				if (addToPage(newpg,tmpTuple) == OK) {
-					putPage(r->ovflow,newp,newpg);
-					pageSetOvflow(prevpg,newp);
-					putPage(r->ovflow,prevp,prevpg);
-					scannedTup++;
-					tmpTuple = tmpTuple + tupLength(tmpTuple) + 1;
-					inserted = 1;
-				}
-			}
-			
+// write out tuples ts[0..n-1], with hash values hs[0..n-1], as
+//  the whole chain for a bucket whose primary page is pid in file f
+// each page is filled in memory and written once; overflow
+//  pages come from reuse[] (pages from the chain being split)
+//  while there are any, then from newOvflowPage()
+
+static void writeChain(Reln r, PageFile f, PageID pid, Tuple *ts, Bits *hs,
+                       Count n, PageID *reuse, Count *nreuse)
+{
+	if (r->ngram != NULL && f == r->data) {
+		ngramClearBucket(r->ngram, pid);
+		for (Count i = 0; i < n; i++) ngramAddTuple(r->ngram, pid, ts[i]);
+	}
+	Page pg = newPage(r->pagesize);
+	for (Count i = 0; i < n; i++) {
+		if (addToPage(pg, ts[i], hs[i]) == OK) continue;
+		// page full; move on to the next page in the chain
+		// (the primary page's filter covers the rest of the chain)
+		if (f == r->data) {
+			for (Count j = i; j < n; j++) pageFilterTuple(pg, ts[j]);
 		}
+		PageID next;
+		if (*nreuse > 0) {
+			next = reuse[0];
+			memmove(reuse, reuse+1, (--*nreuse)*sizeof(PageID));
+		}
+		else
+			next = newOvflowPage(r, (f == r->ovflow) ? pid : NO_PAGE);
+		pageSetOvflow(pg, next);
+		if (pid == fileNPages(f))
+			appendPage(f, pg);
+		else
+			putPage(f, pid, pg);
+		f = r->ovflow;
+		pid = next;
+		pg = newPage(r->pagesize);
+		int ok = addToPage(pg, ts[i], hs[i]);
+		assert(ok == OK);
 	}
+	if (pid == fileNPages(f))
+		appendPage(f, pg);
+	else
+		putPage(f, pid, pg);
+}
 
-	// update depth and sp position
+// Addressing
+// Buckets form 2^depth groups; group g holds the tuples whose hash
+// has g in its lower depth bits, in buckets g, g+N, g+2N, ...
+// (N = 2^depth). With k = expansions, each group starts a round of
+// growth with k buckets and ends it with 2k, gaining one bucket in
+// each of k partial expansions; a partial expansion visits groups
+// in order from sp = 0, spreading each group over one more bucket.
+// k = 1 is ordinary linear hashing (each split doubles a bucket);
+// larger k (Larson's partial expansions) moves a smaller fraction
+// of the file at each step, so bucket loads vary less during a
+// round, at the cost of reading the whole group at each step.
+// Within a group of s buckets, the bits of the hash above depth
+// choose the bucket (groupIndex()). At the end of a round, each
+// group of 2k buckets is two groups of k at the next depth, so
+// no tuples have to move when depth increases.
+
+// which of a group's s buckets holds tuples whose hash, shifted
+//  down depth bits, is x?
+// - s a power of 2: the lower bits of x
+// - s = 2k (end of a round): the lowest bit of x picks which group
+//   at the next depth, the remaining bits a bucket in that group
+// - otherwise: the lower XBITS bits of x modulo s
+
+static Count groupIndex(Count k, Count s, Bits x)
+{
+	if ((s & (s-1)) == 0) return x & (s-1);
+	if (s % 2 == 0 && s/2 >= k) return (x & 1) + 2*groupIndex(k, s/2, x >> 1);
+	return (x & XMASK) % s;
+}
+
+// could groupIndex(k,s,x) be i, given that only the bits of x not
+//  set in unknown are known?
+
+static Bool mayBeIndex(Count k, Count s, Count i, Bits x, Bits unknown)
+{
+	if ((s & (s-1)) == 0) return ((i ^ x) & ~unknown & (s-1)) == 0;
+	if (s % 2 == 0 && s/2 >= k) {
+		if (!(unknown & 1) && (i & 1) != (x & 1)) return FALSE;
+		return mayBeIndex(k, s/2, i >> 1, x >> 1, unknown >> 1);
+	}
+	if ((unknown & XMASK) != 0) return TRUE;
+	return (x & XMASK) % s == i;
+}
+
+// #buckets in group g
+
+static Count groupSize(Reln r, PageID g)
+{
+	return r->expansions + r->phase + (g < r->sp ? 1 : 0);
+}
+
+// which group holds tuples with hash value h?
+
+static PageID groupOf(Reln r, Bits h)
+{
+	return (r->depth == 0) ? 0 : getLower(h, r->depth);
+}
+
+// which bucket holds tuples with hash value h?
+// the lower depth bits give the group, the higher bits the bucket
+//  within the group
+
+static PageID bucketOf(Reln r, Bits h)
+{
+	PageID g = groupOf(r, h);
+	Count i = groupIndex(r->expansions, groupSize(r, g), h >> r->depth);
+	return g + ((PageID)i << r->depth);
+}
+
+// the most buckets in any group
+
+Count maxGroupSize(Reln r)
+{
+	return r->expansions + r->phase + (r->sp > 0 ? 1 : 0);
+}
+
+// the i'th bucket in the group for hash value h, if it could hold
+//  tuples whose hash agrees with h on all bits not set in unknown
+// the bits giving the group (the lower depth bits) must be known
+// returns NO_PAGE if the bucket can't hold such tuples, or if the
+//  group has no i'th bucket
+
+PageID groupBucket(Reln r, Bits h, Bits unknown, Count i)
+{
+	PageID g = groupOf(r, h);
+	Count s = groupSize(r, g);
+	if (i >= s) return NO_PAGE;
+	if (!mayBeIndex(r->expansions, s, i, h >> r->depth, unknown >> r->depth))
+		return NO_PAGE;
+	return g + ((PageID)i << r->depth);
+}
+
+// move the split pointer past the group just expanded, moving on
+//  to the next partial expansion, or the next depth, at the end
+
+static void advanceSplit(Reln r)
+{
+	r->npages++;
 	r->sp++;
 	if (r->sp == 1 << r->depth) {
-		r->depth++;
 		r->sp = 0;
+		r->phase++;
+		if (r->phase == r->expansions) {
+			r->phase = 0;
+			r->depth++;
+		}
+	}
+}
+
+// splitting function to expand the group at the split pointer by
+//  one bucket (with expansions == 1, to split one bucket into two)
+// the group's chains are read once, their tuples partitioned in
+//  memory by groupIndex(), and each bucket of the expanded group
+//  written out once, re-using the old overflow pages
+// split cost is proportional to the size of the group
+void splitting(Reln r)
+{
+	PageID g = r->sp;
+	Count s = groupSize(r, g);
+	PageID newpId = r->npages;
+	assert(newpId == g + ((PageID)s << r->depth));
+
+	// take private copies of all pages in the group's buckets
+	Count nchain = 0, maxchain = 8, ntuples = 0, nreuse = 0;
+	Page *chain = malloc(maxchain*sizeof(Page));
+	PageID *reuse = malloc(maxchain*sizeof(PageID));
+	assert(chain != NULL && reuse != NULL);
+	for (Count b = 0; b < s; b++) {
+		PageFile f = r->data;
+		PageID pid = g + ((PageID)b << r->depth);
+		while (pid != NO_PAGE) {
+			if (nchain == maxchain) {
+				maxchain *= 2;
+				chain = realloc(chain, maxchain*sizeof(Page));
+				reuse = realloc(reuse, maxchain*sizeof(PageID));
+				assert(chain != NULL && reuse != NULL);
+			}
+			if (f == r->ovflow) reuse[nreuse++] = pid;
+			Page pg = getPage(f, pid);
+			chain[nchain] = clonePage(pg);
+			releasePage(pg);
+			ntuples += pageNTuples(chain[nchain]);
+			pid = pageOvflow(chain[nchain++]);
+			f = r->ovflow;
+		}
+	}
+
+	// partition tuples among the s+1 buckets
+	// part[start[b] .. start[b+1]-1] are bucket b's tuples
+	// (with hash values in phash[])
+	Tuple *tups = malloc((ntuples+1)*sizeof(Tuple));
+	Bits *hash = malloc((ntuples+1)*sizeof(Bits));
+	Count *which = malloc((ntuples+1)*sizeof(Count));
+	Tuple *part = malloc((ntuples+1)*sizeof(Tuple));
+	Bits *phash = malloc((ntuples+1)*sizeof(Bits));
+	Count *start = calloc(s+2, sizeof(Count));
+	assert(tups != NULL && hash != NULL && which != NULL);
+	assert(part != NULL && phash != NULL && start != NULL);
+	Count n = 0;
+	for (Count k = 0; k < nchain; k++) {
+		for (Count i = 0; i < pageNTuples(chain[k]); i++) {
+			tups[n] = pageTuple(chain[k], i);
+			hash[n] = hashOf(r, chain[k], i);
+			which[n] = groupIndex(r->expansions, s+1, hash[n] >> r->depth);
+			start[which[n]+1]++;
+			n++;
+		}
+	}
+	for (Count b = 0; b <= s; b++) start[b+1] += start[b];
+	Count *next = malloc((s+1)*sizeof(Count));
+	assert(next != NULL);
+	memcpy(next, start, (s+1)*sizeof(Count));
+	for (Count i = 0; i < n; i++) {
+		Count j = next[which[i]]++;
+		part[j] = tups[i];
+		phash[j] = hash[i];
+	}
+
+	// write all buckets; overflow pages not needed are freed
+	Count nleft = nreuse;
+	for (Count b = 0; b <= s; b++) {
+		PageID pid = g + ((PageID)b << r->depth);
+		writeChain(r, r->data, pid, part+start[b], phash+start[b],
+		           start[b+1]-start[b], reuse, &nleft);
+	}
+	for (Count k = 0; k < nleft; k++) freeOvflowPage(r, reuse[k]);
+
+	for (Count k = 0; k < nchain; k++) free(chain[k]);
+	free(chain); free(reuse); free(tups); free(hash); free(which);
+	free(part); free(phash); free(start); free(next);
+
+	// update depth and sp position
+	advanceSplit(r);
+}
+
+// tuples to be inserted, tagged with their bucket, so that they
+//  can be sorted into groups for insertBatchIntoBucket()
+
+typedef struct { PageID bucket; Count index; } BatchItem;
+
+static int cmpBatchItem(const void *a, const void *b)
+{
+	const BatchItem *x = a, *y = b;
+	if (x->bucket != y->bucket) return (x->bucket < y->bucket) ? -1 : 1;
+	return (x->index < y->index) ? -1 : (x->index > y->index);
+}
+
+// Incremental splitting
+// With r->incremental, a split only adds the new bucket and moves
+// the split pointer on (startSplit()); the tuples in the group are
+// moved to their new buckets a page at a time, one page after each
+// later insert (splitStep()), so no insert pays for a whole group.
+// While a group is half-split:
+// - inserts go where the new addressing says; tuples which would
+//   stay put are already in the right bucket, and any that move
+//   are inserted in their new bucket before their old page is
+//   rewritten without them
+// - a tuple may still be in its bucket under the old addressing,
+//   so selections also scan those buckets (splitSources())
+// - emptied overflow pages are unlinked from the chain and freed,
+//   and once a bucket is drained, what's left of its chain is
+//   repacked into as few pages as it needs (repackBucket())
+// A split which comes due while another is half done finishes the
+// earlier one first, as does closing the relation.
+
+static void startSplit(Reln r)
+{
+	r->pgroup = r->sp;
+	r->pdepth = r->depth;
+	r->psize = groupSize(r, r->sp);
+	PageID newpId = addPage(r->data);
+	assert(newpId == r->npages);
+	advanceSplit(r);
+	r->pending = TRUE;
+	r->pbucket = 0;
+	r->ppid = r->pgroup;
+	r->pprev = NO_PAGE;
+	r->pshrunk = FALSE;
+}
+
+// rewrite the chain of a bucket with overflow pages, which may
+//  have been left part-empty by splitStep(), so its tuples fill
+//  the fewest pages; overflow pages no longer needed are freed
+
+static void repackBucket(Reln r, PageID bucket)
+{
+	Page pg = getPage(r->data, bucket);
+	PageID pid = pageOvflow(pg);
+	releasePage(pg);
+	if (pid == NO_PAGE) return;
+
+	// take private copies of the bucket's pages
+	Count nchain = 0, maxchain = 8, ntuples = 0, nreuse = 0;
+	Page *chain = malloc(maxchain*sizeof(Page));
+	PageID *reuse = malloc(maxchain*sizeof(PageID));
+	assert(chain != NULL && reuse != NULL);
+	PageFile f = r->data;
+	pid = bucket;
+	while (pid != NO_PAGE) {
+		if (nchain == maxchain) {
+			maxchain *= 2;
+			chain = realloc(chain, maxchain*sizeof(Page));
+			reuse = realloc(reuse, maxchain*sizeof(PageID));
+			assert(chain != NULL && reuse != NULL);
+		}
+		if (f == r->ovflow) reuse[nreuse++] = pid;
+		pg = getPage(f, pid);
+		chain[nchain] = clonePage(pg);
+		releasePage(pg);
+		ntuples += pageNTuples(chain[nchain]);
+		pid = pageOvflow(chain[nchain++]);
+		f = r->ovflow;
+	}
+
+	Tuple *tups = malloc((ntuples+1)*sizeof(Tuple));
+	Bits *hash = malloc((ntuples+1)*sizeof(Bits));
+	assert(tups != NULL && hash != NULL);
+	Count n = 0;
+	for (Count k = 0; k < nchain; k++) {
+		for (Count i = 0; i < pageNTuples(chain[k]); i++) {
+			tups[n] = pageTuple(chain[k], i);
+			hash[n++] = hashOf(r, chain[k], i);
+		}
+	}
+	Count nleft = nreuse;
+	writeChain(r, r->data, bucket, tups, hash, n, reuse, &nleft);
+	for (Count k = 0; k < nleft; k++) freeOvflowPage(r, reuse[k]);
+
+	for (Count k = 0; k < nchain; k++) free(chain[k]);
+	free(chain); free(reuse); free(tups); free(hash);
+}
+
+// drain one page of the half-split group
+
+static void splitStep(Reln r)
+{
+	if (!r->pending) return;
+	PageID bucket = r->pgroup + ((PageID)r->pbucket << r->pdepth);
+	PageFile f = (r->pprev == NO_PAGE) ? r->data : r->ovflow;
+	Page pg = getPage(f, r->ppid);
+	Page old = clonePage(pg);
+	releasePage(pg);
+	PageID next = pageOvflow(old);
+
+	// sort the page's tuples into those staying and those moving
+	Count n = pageNTuples(old);
+	Page keep = newPage(r->pagesize);
+	pageSetOvflow(keep, next);
+	// a primary page's filter also covers the rest of its chain
+	if (r->pprev == NO_PAGE) pageCopyFilter(keep, old);
+	BatchItem *moving = malloc((n+1)*sizeof(BatchItem));
+	Tuple *group = malloc((n+1)*sizeof(Tuple));
+	Bits *hash = malloc((n+1)*sizeof(Bits));
+	Bits *ghash = malloc((n+1)*sizeof(Bits));
+	assert(moving != NULL && group != NULL && hash != NULL && ghash != NULL);
+	Count nmoving = 0;
+	for (Count i = 0; i < n; i++) {
+		hash[i] = hashOf(r, old, i);
+		PageID b = bucketOf(r, hash[i]);
+		if (b == bucket) {
+			int ok = addToPage(keep, pageTuple(old, i), hash[i]);
+			assert(ok == OK);
+		}
+		else {
+			moving[nmoving].bucket = b;
+			moving[nmoving++].index = i;
+		}
+	}
+
+	// insert the moving tuples in their new buckets
+	qsort(moving, nmoving, sizeof(BatchItem), cmpBatchItem);
+	for (Count k = 0; k < nmoving; ) {
+		Count g = 0;
+		PageID b = moving[k].bucket;
+		for (Count j = k; j < nmoving && moving[j].bucket == b; j++) {
+			group[g] = pageTuple(old, moving[j].index);
+			ghash[g++] = hash[moving[j].index];
+		}
+		if (insertBatchIntoBucket(r, b, group, ghash, g, NULL) < g)
+			fatal("Can't move tuple during split");
+		k += g;
+	}
+
+	// rewrite the page without them (or drop it, if now empty)
+	if (nmoving > 0) r->pshrunk = TRUE;
+	Bool dropped = FALSE;
+	if (nmoving == 0)
+		free(keep);
+	else if (pageNTuples(keep) == 0 && r->pprev != NO_PAGE) {
+		PageFile pf = r->pprimary ? r->data : r->ovflow;
+		Page prev = getPage(pf, r->pprev);
+		pageSetOvflow(prev, next);
+		putPage(pf, r->pprev, prev);
+		freeOvflowPage(r, r->ppid);
+		free(keep);
+		dropped = TRUE;
+	}
+	else
+		putPage(f, r->ppid, keep);
+	free(old); free(moving); free(group); free(hash); free(ghash);
+
+	// move on to the next page in the group
+	if (!dropped) {
+		r->pprimary = (r->pprev == NO_PAGE);
+		r->pprev = r->ppid;
+	}
+	r->ppid = next;
+	if (r->ppid == NO_PAGE) {
+		if (r->pshrunk) repackBucket(r, bucket);
+		r->pshrunk = FALSE;
+		r->pbucket++;
+		r->ppid = r->pgroup + ((PageID)r->pbucket << r->pdepth);
+		r->pprev = NO_PAGE;
+		if (r->pbucket == r->psize) r->pending = FALSE;
+	}
+}
+
+// complete any half-split group
+
+static void finishSplit(Reln r)
+{
+	while (r->pending) splitStep(r);
+}
+
+// split the group at the split pointer, or start splitting it
+
+static void split(Reln r)
+{
+	if (r->incremental) {
+		finishSplit(r);
+		startSplit(r);
 	}
+	else
+		splitting(r);
+}
+
+// #buckets in the half-split group, before its split (0 if none)
+// this can be more than maxGroupSize(r), when the split ended a
+//  round of expansions
+
+Count splitGroupSize(Reln r)
+{
+	return r->pending ? r->psize : 0;
+}
+
+// the buckets of a half-split group which, under the addressing
+//  from before the split, might still hold tuples whose hash agrees
+//  with h on all bits not set in unknown; ids go in buckets[], which
+//  must have room for splitGroupSize(r) of them
+// returns how many there are (0 if no group is half-split)
+
+Count splitSources(Reln r, Bits h, Bits unknown, PageID *buckets)
+{
+	if (!r->pending) return 0;
+	Bits low = (r->pdepth == 0) ? 0 : getLower(h, r->pdepth);
+	if (low != r->pgroup) return 0;
+	Count n = 0;
+	for (Count i = 0; i < r->psize; i++) {
+		if (mayBeIndex(r->expansions, r->psize, i, h >> r->pdepth,
+		               unknown >> r->pdepth))
+			buckets[n++] = r->pgroup + ((PageID)i << r->pdepth);
+	}
+	return n;
+}
+
+// Split policy
+// loadfactor == 0: split every pagecap insertions (older relations)
+// otherwise: split whenever inserting a tuple would take the space
+//  used by tuples (nbytes) past loadfactor% of the total space in
+//  primary pages, so short tuples don't cause needless splits, and
+//  long ones don't pile up in overflow chains
+
+// is a split due before inserting a tuple needing space bytes?
+
+static Bool splitDue(Reln r, Count space)
+{
+	if (r->loadfactor == 0) return r->curcap == r->pagecap;
+	Offset capacity = (Offset)r->npages*pageCapacity(r->pagesize);
+	return (r->nbytes + space)*100 > capacity*r->loadfactor;
+}
+
+// account for inserting a tuple needing space bytes
+
+static void noteInsert(Reln r, Count space)
+{
+	r->curcap++;
+	r->nbytes += space;
 }
 
 // insert a new tuple into a relation
@@ -256,105 +1060,246 @@ void splitting(Reln r)
 // TODO: include splitting and file expansion
 PageID addToRelation(Reln r, Tuple t)
 {
-	// if current insertion count reach the max insertion capacity, split page first, then insert
-	if (r->curcap == r->pagecap) {
-		splitting(r);
+	// if the file is full enough, split page first, then insert
+	if (splitDue(r, tupleSpace(t))) {
+		split(r);
 		r->curcap = 0;
 	}
 
-	r->curcap++;
+	noteInsert(r, tupleSpace(t));
 	Bits h, p;
 	// char buf[MAXBITS+5]; //*** for debug
 	// hash tuple
 	h = tupleHash(r,t);
 	// find the pageId to store tuple
-	// compute the lowest d bits or d + 1 in tuple's hash value depends on split pointer
-	// the computed result decided which page to store
-	if (r->depth == 0)
-		p = 0;
-	else {
-		p = getLower(h, r->depth);
-		if (p < r->sp) p = getLower(h, r->depth+1);
-	}
+	p = bucketOf(r, h);
 	// bitsString(h,buf); printf("hash = %s\n",buf); //*** for debug
 	// bitsString(p,buf); printf("page = %s\n",buf); //*** for debug
-	Page pg = getPage(r->data,p);
-	// insert into page if there is enough space in page
-	if (addToPage(pg,t) == OK) {
-		putPage(r->data,p,pg);
-		r->ntups++;
-		return p;
-	}
-
-	// primary data page full, looking for overflow page
-	// if there is no overflow page under current page
-	// create the first overflow page and add tuple into overflow page
-	if (pageOvflow(pg) == NO_PAGE) {
-		// add first overflow page in chain
-		PageID newp = addPage(r->ovflow);
-		pageSetOvflow(pg,newp);
-		putPage(r->data,p,pg);
-		Page newpg = getPage(r->ovflow,newp);
-		// can't add to a new page; we have a problem
-		if (addToPage(newpg,t) != OK) return NO_PAGE;
-		putPage(r->ovflow,newp,newpg);
-		r->ntups++;
-		return p;
-	}
-	// there is overflow page, start scanning overflow page to add tuple in it
-	else {
-		// scan overflow chain until we find space
-		// worst case: add new ovflow page at end of chain
-		Page ovpg, prevpg = NULL;
-		PageID ovp, prevp = NO_PAGE;
-		ovp = pageOvflow(pg);
-		free(pg);
-
-		// looping all oveflow pages
-		while (ovp != NO_PAGE) {
-			ovpg = getPage(r->ovflow, ovp);
-			// go to next overflow page if cannot add tuple
-			if (addToPage(ovpg,t) != OK) {
-			    if (prevpg != NULL) free(prevpg);
-				prevp = ovp; prevpg = ovpg;
-				ovp = pageOvflow(ovpg);
+	if (insertIntoBucket(r, p, t, h) == NO_PAGE) return NO_PAGE;
+	r->ntups++;
+	splitStep(r);
+	return p;
+}
+
+// insert a batch of tuples ts[0..n-1] into a relation
+// the result is the same as calling addToRelation() for each in
+//  turn, but tuples headed for the same bucket are inserted
+//  together, with one pass along the bucket's chain
+// the batch is processed in runs of the tuples inserted between
+//  one split and the next, so splits happen at the same points
+// if pids is not NULL, pids[i] is set to ts[i]'s bucket (or to
+//  NO_PAGE if it could not be inserted)
+// returns non-OK if some tuple could not be inserted
+
+Status addBatchToRelation(Reln r, Tuple *ts, Count n, PageID *pids)
+{
+	Status status = OK;
+	BatchItem *items = malloc((n+1)*sizeof(BatchItem));
+	Bits *hash = malloc((n+1)*sizeof(Bits));
+	Tuple *group = malloc((n+1)*sizeof(Tuple));
+	Bits *ghash = malloc((n+1)*sizeof(Bits));
+	Bool *failed = malloc((n+1)*sizeof(Bool));
+	assert(items != NULL && hash != NULL && group != NULL);
+	assert(ghash != NULL && failed != NULL);
+	tupleHashes(r, ts, n, hash);
+
+	Count i = 0;
+	while (i < n) {
+		if (splitDue(r, tupleSpace(ts[i]))) {
+			split(r);
+			r->curcap = 0;
+		}
+		// tuples i..i+m-1 go in before the next split
+		Count m = 0;
+		do {
+			noteInsert(r, tupleSpace(ts[i+m]));
+			m++;
+		} while (i+m < n && !splitDue(r, tupleSpace(ts[i+m])));
+		for (Count k = 0; k < m; k++) {
+			items[k].bucket = bucketOf(r, hash[i+k]);
+			items[k].index = i+k;
+		}
+		qsort(items, m, sizeof(BatchItem), cmpBatchItem);
+		for (Count k = 0; k < m; ) {
+			Count g = 0;
+			PageID b = items[k].bucket;
+			for (Count j = k; j < m && items[j].bucket == b; j++) {
+				group[g] = ts[items[j].index];
+				ghash[g++] = hash[items[j].index];
 			}
-			// if can add tuple into overflow page, add it
-			else {
-				if (prevpg != NULL) free(prevpg);
-				putPage(r->ovflow,ovp,ovpg);
-				r->ntups++;
-				return p;
+			Count ok = insertBatchIntoBucket(r, b, group, ghash, g, failed);
+			if (ok < g) status = ~OK;
+			r->ntups += ok;
+			if (pids != NULL) {
+				for (Count j = 0; j < g; j++)
+					pids[items[k+j].index] = failed[j] ? NO_PAGE : b;
 			}
+			k += g;
 		}
-		// all overflow pages are full; add another to chain
-		// at this point, there *must* be a prevpg
-		assert(prevpg != NULL);
-		// make new ovflow page
-		PageID newp = addPage(r->ovflow);
-		// insert tuple into new page
-		Page newpg = getPage(r->ovflow,newp);
-        if (addToPage(newpg,t) != OK) return NO_PAGE;
-        putPage(r->ovflow,newp,newpg);
-		// link to existing overflow chain
-		pageSetOvflow(prevpg,newp);
-		putPage(r->ovflow,prevp,prevpg);
-        r->ntups++;
-		return p;
+		for (Count k = 0; k < m; k++) splitStep(r);
+		i += m;
 	}
-	return NO_PAGE;
+	free(items); free(hash); free(group); free(ghash); free(failed);
+	return status;
+}
+
+// write out a page built by bulkLoadRelation()
+// pages are produced in file order, so any page beyond the end
+//  of the file is the next one to append
+
+static void putBulkPage(PageFile f, PageID pid, Page pg)
+{
+	if (pid < fileNPages(f))
+		putPage(f, pid, pg);
+	else {
+		PageID p = appendPage(f, pg);
+		assert(p == pid);
+	}
+}
+
+// load all tuples from in into an empty relation
+// the relation ends up as if the tuples had been inserted one at
+//  a time (same depth, split pointer and #pages), but each tuple
+//  is hashed once, and each page is written once, in file order:
+// - read all tuples and hash them
+// - work out how many splits the inserts would have caused
+// - partition the tuples by bucket (a counting sort)
+// - fill each bucket's primary page, then its overflow pages,
+//   which are allocated consecutively at the end of .ovflow
+// if the relation already holds tuples, they are added one at a
+//  time with addToRelation()
+// returns non-OK if some tuple could not be stored
+
+Status bulkLoadRelation(Reln r, FILE *in)
+{
+	Tuple t;
+	if (r->ntups > 0) {
+		while ((t = readTuple(r,in)) != NULL) {
+			PageID pid = addToRelation(r,t);
+			free(t);
+			if (pid == NO_PAGE) return ~OK;
+		}
+		return OK;
+	}
+
+	// read and hash all tuples
+	Count n = 0, max = 1024;
+	Tuple *tups = malloc(max*sizeof(Tuple));
+	Bits *hash = malloc(max*sizeof(Bits));
+	assert(tups != NULL && hash != NULL);
+	while ((t = readTuple(r,in)) != NULL) {
+		if (n == max) {
+			max *= 2;
+			tups = realloc(tups, max*sizeof(Tuple));
+			hash = realloc(hash, max*sizeof(Bits));
+			assert(tups != NULL && hash != NULL);
+		}
+		tups[n++] = t;
+	}
+	tupleHashes(r, tups, n, hash);
+
+	// replay the split policy (see addToRelation())
+	for (Count i = 0; i < n; i++) {
+		if (splitDue(r, tupleSpace(tups[i]))) {
+			advanceSplit(r);
+			r->curcap = 0;
+		}
+		noteInsert(r, tupleSpace(tups[i]));
+	}
+	r->ntups = n;
+
+	// partition tuples by bucket
+	// start[b] .. start[b+1]-1 index bucket b's tuples in order[]
+	Count *start = calloc(r->npages+1, sizeof(Count));
+	Count *order = malloc((n+1)*sizeof(Count));
+	PageID *bucket = malloc((n+1)*sizeof(PageID));
+	assert(start != NULL && order != NULL && bucket != NULL);
+	for (Count i = 0; i < n; i++) {
+		bucket[i] = bucketOf(r, hash[i]);
+		start[bucket[i]+1]++;
+	}
+	for (PageID b = 0; b < r->npages; b++) start[b+1] += start[b];
+	for (Count i = 0; i < n; i++) order[start[bucket[i]]++] = i;
+	for (PageID b = r->npages; b > 0; b--) start[b] = start[b-1];
+	start[0] = 0;
+
+	// build each bucket's chain
+	Status status = OK;
+	PageID nextov = fileNPages(r->ovflow);
+	for (PageID b = 0; b < r->npages; b++) {
+		PageFile f = r->data;
+		PageID pid = b;
+		Page pg = newPage(r->pagesize);
+		for (Count k = start[b]; k < start[b+1]; k++) {
+			t = tups[order[k]];
+			if (r->ngram != NULL) ngramAddTuple(r->ngram, b, t);
+			Bits h = hash[order[k]];
+			if (addToPage(pg,t,h) == OK) continue;
+			// page full; it links to the next overflow page
+			// (the primary page's filter covers the rest of the chain)
+			if (f == r->data) {
+				for (Count j = k; j < start[b+1]; j++)
+					pageFilterTuple(pg, tups[order[j]]);
+			}
+			pageSetOvflow(pg, nextov);
+			putBulkPage(f, pid, pg);
+			f = r->ovflow;
+			pid = nextov++;
+			pg = newPage(r->pagesize);
+			if (addToPage(pg,t,h) != OK) status = ~OK;
+		}
+		putBulkPage(f, pid, pg);
+	}
+
+	for (Count i = 0; i < n; i++) free(tups[i]);
+	free(tups); free(hash);
+	free(start); free(order); free(bucket);
+	return status;
+}
+
+// build a trigram index on attribute att (0-based) of an open
+//  relation, replacing any it has, by scanning every bucket
+// the index is written out when the relation is closed
+
+Status indexRelation(Reln r, Count att)
+{
+	if (r->mode != 'w' || att >= r->nattrs) return ~OK;
+	finishSplit(r);
+	freeNgramIndex(r->ngram);
+	r->ngram = newNgramIndex(r->name, att);
+	r->ngramatt = att+1;
+	for (PageID b = 0; b < r->npages; b++) {
+		ngramClearBucket(r->ngram, b);
+		PageFile f = r->data;
+		PageID pid = b;
+		while (pid != NO_PAGE) {
+			Page pg = getPage(f, pid);
+			for (Count k = 0; k < pageNTuples(pg); k++)
+				ngramAddTuple(r->ngram, b, pageTuple(pg, k));
+			pid = pageOvflow(pg);
+			releasePage(pg);
+			f = r->ovflow;
+		}
+	}
+	return OK;
 }
 
 // external interfaces for Reln data
 
-FILE *dataFile(Reln r) { return r->data; }
-FILE *ovflowFile(Reln r) { return r->ovflow; }
+PageFile dataFile(Reln r) { return r->data; }
+PageFile ovflowFile(Reln r) { return r->ovflow; }
 Count nattrs(Reln r) { return r->nattrs; }
 Count npages(Reln r) { return r->npages; }
 Count ntuples(Reln r) { return r->ntups; }
 Count depth(Reln r)  { return r->depth; }
 Count splitp(Reln r) { return r->sp; }
+Count novflow(Reln r) { return fileNPages(r->ovflow) - r->nfree; }
+Bool ovflowIsFree(Reln r, PageID pid) { return isFree(r, pid); }
+Count pagesize(Reln r) { return r->pagesize; }
 ChVecItem *chvec(Reln r)  { return r->cv; }
+ChVecPlan chvecPlan(Reln r) { return r->plan; }
+NgramIndex ngramIndex(Reln r) { return r->ngram; }
+Count hashfn(Reln r) { return r->hashfn; }
 
 
 // displays info about open Reln
@@ -362,29 +1307,43 @@ ChVecItem *chvec(Reln r)  { return r->cv; }
 void relationStats(Reln r)
 {
 	printf("Global Info:\n");
-	printf("#attrs:%d  #pages:%d  #tuples:%d  d:%d  sp:%d\n",
-	       r->nattrs, r->npages, r->ntups, r->depth, r->sp);
+	printf("#attrs:%d  #pages:%d  #tuples:%d  d:%d  sp:%llu  pagesize:%d\n",
+	       r->nattrs, r->npages, r->ntups, r->depth, r->sp, r->pagesize);
+	if (r->loadfactor > 0) {
+		Offset capacity = (Offset)r->npages*pageCapacity(r->pagesize);
+		printf("load:%llu%%  target load:%d%%\n", 100*r->nbytes/capacity, r->loadfactor);
+	}
+	else
+		printf("split every %d insertions\n", r->pagecap);
+	if (r->expansions > 1)
+		printf("partial expansions:%d  in expansion:%d\n", r->expansions, r->phase+1);
+	if (r->hashfn != HASH_PG)
+		printf("hash function:%s\n", hashName(r->hashfn));
+	if (r->ngram != NULL)
+		printf("trigram index on attribute:%d\n", ngramAttr(r->ngram)+1);
+	printf("#free ovflow pages:%d\n", r->nfree);
 	printf("Choice vector\n");
 	printChVec(r->cv);
 	printf("Bucket Info:\n");
 	printf("%-4s %s\n","#","Info on pages in bucket");
 	printf("%-4s %s\n","","(pageID,#tuples,freebytes,ovflow)");
+	advisePageFile(r->data, 0, 0, PF_SEQUENTIAL);
 	for (Offset pid = 0; pid < r->npages; pid++) {
-		printf("[%2d]  ",pid);
+		printf("[%2llu]  ",pid);
 		Page p = getPage(r->data, pid);
 		Count ntups = pageNTuples(p);
 		Count space = pageFreeSpace(p);
 		Offset ovid = pageOvflow(p);
-		printf("(d%d,%d,%d,%d)",pid,ntups,space,ovid);
-		free(p);
+		printf("(d%llu,%d,%d,%lld)",pid,ntups,space,(long long)ovid);
+		releasePage(p);
 		while (ovid != NO_PAGE) {
 			Offset curid = ovid;
 			p = getPage(r->ovflow, ovid);
 			ntups = pageNTuples(p);
 			space = pageFreeSpace(p);
 			ovid = pageOvflow(p);
-			printf(" -> (ov%d,%d,%d,%d)",curid,ntups,space,ovid);
-			free(p);
+			printf(" -> (ov%llu,%d,%d,%lld)",curid,ntups,space,(long long)ovid);
+			releasePage(p);
 		}
 		putchar('\n');
 	}
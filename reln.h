@@ -9,22 +9,40 @@
 typedef struct RelnRep *Reln;
 
 #include "defs.h"
+#include "pagefile.h"
 #include "tuple.h"
 #include "page.h"
 #include "chvec.h"
+#include "bits.h"
+#include "ngram.h"
 
-Status newRelation(char *name, Count nattr, Count npages, Count d, char *cv);
+Status newRelation(char *name, Count nattr, Count npages, Count d, char *cv,
+                   Count pagesize, Count loadfactor, Count expansions,
+                   Count hashfn);
 Reln openRelation(char *name, char *mode);
 void closeRelation(Reln r);
 Bool existsRelation(char *name);
 PageID addToRelation(Reln r, Tuple t);
-FILE *dataFile(Reln r);
-FILE *ovflowFile(Reln r);
+Status addBatchToRelation(Reln r, Tuple *ts, Count n, PageID *pids);
+Status bulkLoadRelation(Reln r, FILE *in);
+Status indexRelation(Reln r, Count att);
+PageFile dataFile(Reln r);
+PageFile ovflowFile(Reln r);
 Count nattrs(Reln r);
 Count npages(Reln r);
 Count depth(Reln r);
 Count splitp(Reln r);
+Count novflow(Reln r);
+Bool ovflowIsFree(Reln r, PageID pid);
+Count maxGroupSize(Reln r);
+PageID groupBucket(Reln r, Bits h, Bits unknown, Count i);
+Count splitGroupSize(Reln r);
+Count splitSources(Reln r, Bits h, Bits unknown, PageID *buckets);
+Count pagesize(Reln r);
 ChVecItem *chvec(Reln r);
+ChVecPlan chvecPlan(Reln r);
+Count hashfn(Reln r);
+NgramIndex ngramIndex(Reln r);
 void relationStats(Reln r);
 
 #endif
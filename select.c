@@ -10,6 +10,14 @@
 #include "tuple.h"
 #include "bits.h"
 #include "hash.h"
+#include "page.h"
+#include "pred.h"
+
+// #candidate buckets to read ahead of the scan (0 = no prefetch)
+static Count prefetchDepth = PREFETCH;
+
+// cost of reading a page at random, in sequential page reads
+#define RANDOMCOST 4
 
 // A suggestion ... you can change however you like
 
@@ -17,20 +25,108 @@ struct SelectionRep {
 	Reln    rel;                        // need to remember Relation info
 	Bits    known;                      // the hash value from MAH
 	Bits    unknown;                    // the unknown bits from MAH
-	Page    curpage;                    // current page in scan
+	Page    curpage;                    // current page in scan (NULL if none)
 	int     is_ovflow;                  // are we in the overflow pages?
-	Offset  curtupOffset;               // offset of current tuple within page
+	Offset  curtupOffset;               // index of next tuple within page
 	//TODO
-    Count   queryDepth;                 // depth of query in data file
-    Bits    nstars;                     // total number of stars in lower bit
-    Bits    totalcandidatePages;        // the number of candidate page when there is unknown bits in lower bits d
-    Bits    curcandidatePage;           // current candidate page
+    Bits    nstars;                     // total number of stars in lower depth bits
     int     starsPosition[MAXCHVEC];    // store the unknown star position
+    PageID *buckets;                    // candidate buckets, in scan order
+    Count   nbuckets;                   // number of candidate buckets
+    Count   curbucket;                  // next candidate bucket (or page,
+    Count   prefetched;                 //   if seqscan) to visit / prefetch
+
+    Count   ncands;                     // number of candidate buckets found
+    Bool    seqscan;                    // scan both files, not the candidates?
+    double  probeCost;                  // estimated costs (see planSelection())
+    double  scanCost;
 
     Tuple   queryTuple;                 // query tuple like '1024,?,?'
-    Tuple   curTuple;                   // tuple in current scan
+    Bits   *keys;                       // filter keys of known values
+    Count   nkeys;                      //  (see pageMayHold())
+    Pred    pred;                       // queryTuple, compiled
 };
 
+// the hash value for the c'th combination of values for the
+//   star bits in the group address (the lower depth bits)
+
+static Bits starCombo(Selection q, Bits c)
+{
+    Bits mav = q->known;
+    for (int i = 0; i < q->nstars; i++) {
+        if (bitIsSet(c, i)) mav = setBit(mav, q->starsPosition[i]);
+    }
+    return mav;
+}
+
+// Planning
+// A selection can either probe its candidate buckets, reading each
+// one's primary page and overflow chain, or scan the data file and
+// then the overflow file from start to end, testing every tuple.
+// Probing reads fewer pages, but each is a random read; scanning
+// reads every page in use, but in order, so the OS and the buffer
+// pool can read ahead in large blocks. In sequential page reads:
+// - probe: #candidates * average chain length * RANDOMCOST
+// - scan:  #data pages + #overflow pages in use
+// When most star bits are in the group address, nearly every
+// bucket is a candidate, and the scan is cheaper.
+
+static void planSelection(Selection q)
+{
+    Reln r = q->rel;
+    double chain = 1.0 + (double)novflow(r)/npages(r);
+    q->probeCost = RANDOMCOST * chain * q->nbuckets;
+    q->scanCost = npages(r) + novflow(r);
+    q->seqscan = (q->scanCost < q->probeCost);
+}
+
+// the file and id of page i of a sequential scan: the data pages
+//   in order, then the overflow pages
+// returns FALSE if page i is a free overflow page
+
+static Bool scanPage(Selection q, Count i, PageFile *f, PageID *pid)
+{
+    Reln r = q->rel;
+    if (i < npages(r)) {
+        *f = dataFile(r);
+        *pid = i;
+        return TRUE;
+    }
+    *f = ovflowFile(r);
+    *pid = i - npages(r);
+    return !ovflowIsFree(r, *pid);
+}
+
+// keep the primary pages of the next prefetchDepth candidate
+//   buckets (or the next prefetchDepth pages of a sequential scan)
+//   on their way in, so that the scan isn't waiting on one read at
+//   a time
+
+static void prefetchBuckets(Selection q)
+{
+    while (q->prefetched < q->nbuckets
+           && q->prefetched < q->curbucket + prefetchDepth) {
+        if (!q->seqscan)
+            prefetchPage(dataFile(q->rel), q->buckets[q->prefetched]);
+        else {
+            PageFile f; PageID pid;
+            if (scanPage(q, q->prefetched, &f, &pid)) prefetchPage(f, pid);
+        }
+        q->prefetched++;
+    }
+}
+
+// the next overflow page in the current bucket is known as soon
+//   as we have its predecessor, so start reading it while the
+//   current page is scanned
+
+static void startOvflowRead(Selection q)
+{
+    if (prefetchDepth == 0 || q->seqscan) return;
+    Offset ovid = pageOvflow(q->curpage);
+    if (ovid != NO_PAGE) prefetchPage(ovflowFile(q->rel), ovid);
+}
+
 // take a query string (e.g. "1234,?,abc,?")
 // set up a SelectionRep object for the scan
 
@@ -43,72 +139,94 @@ Selection startSelection(Reln r, char *q)
     new->known = 0;
     new->unknown = 0;
     new->nstars = 0;
+    new->nkeys = 0;
     new->queryTuple = q;
+    new->pred = compilePred(r, q);
     Count nvals = nattrs(r);
-    char **vals = malloc(nvals*sizeof(char *));
-    assert(vals != NULL);
-    tupleVals(q, vals);
+    Field vals[nvals];
+    tupleFields(q, vals, nvals);
+    new->keys = malloc(nvals*sizeof(Bits));
+    assert(new->keys != NULL);
 
     // TODO
-    // char buf[MAXBITS+1];  //*** for debug
-	Bits valsHash[nvals];
+	// form known bits from known attributes
+	// form unknown bits from '?' and '%' attributes
+	// (using the compiled choice vector; see gatherBits())
+	// the lower depth bits address a group of buckets, and
+	//   higher bits a bucket within the group
+    ChVecPlan plan = chvecPlan(r);
+    HashFunc hash = hashFunction(hashfn(r));
 	for (int i = 0; i < nvals; i++) {
-        if (!strchr(vals[i], '?') && !strchr(vals[i], '%')) {
-    		valsHash[i] = hash_any((unsigned char *)vals[i],strlen(vals[i]));
+        if (!memchr(vals[i].val, '?', vals[i].len)
+            && !memchr(vals[i].val, '%', vals[i].len)) {
+    		Bits h = hash((unsigned char *)vals[i].val, vals[i].len);
+            new->known |= gatherBits(plan, i, h);
+            new->keys[new->nkeys++] = filterKey(i, vals[i].val, vals[i].len);
         }
-        // bitsString(valsHash[i],buf);  //*** for debug
-        // printf("hash(%20s) = %s\n", vals[i], buf);  //*** for debug
+        else
+            new->unknown |= attrBits(plan, i);
 	}
+    for (int i = 0; i < depth(r); i++) {
+        if (bitIsSet(new->unknown, i))
+            new->starsPosition[new->nstars++] = i;
+    }
 
-	// Partial algorithm:
-	// form known bits from known attributes
-	// form unknown bits from '?' and '%' attributes
-    int starIdx = 0;
-	ChVecItem *cv = chvec(r);
-    for (int i = 0; i < depth(r) + 1; i++) {
-        if (!strchr(vals[cv[i].att], '?') && !strchr(vals[cv[i].att], '%')) {
-            if (bitIsSet(valsHash[cv[i].att], cv[i].bit)){
-                new->known = setBit(new->known, i);
-            }
+	// every combination of values for the star bits gives a
+	//   candidate group; the buckets in each group which could
+	//   hold matching tuples are candidates (see groupBucket())
+	// candidates are taken in file order: the first bucket of
+	//   each group, then the second, ...
+    // (room for ncombos groups, plus the half-split group)
+    Bits ncombos = (Bits)1 << new->nstars;
+    Count gsize = maxGroupSize(r);
+    Count psize = splitGroupSize(r);
+    new->buckets = malloc((ncombos*gsize+psize+1)*sizeof(PageID));
+    assert(new->buckets != NULL);
+    new->nbuckets = 0;
+    for (Count i = 0; i < gsize; i++) {
+        for (Bits c = 0; c < ncombos; c++) {
+            PageID b = groupBucket(r, starCombo(new, c), new->unknown, i);
+            if (b != NO_PAGE) new->buckets[new->nbuckets++] = b;
         }
     }
-
-	// compute PageID of first page
-	//   using known bits and first "unknown" value
-    Bits firstPage;
-	if (depth(r) == 0)
-		firstPage = 0;
-	else {
-		new->queryDepth = depth(r);
-        firstPage = getLower(new->known, new->queryDepth);
-        // get one more bit if pageId is smaller than split pointer
-		if (firstPage < splitp(r)) {
-            new->queryDepth++;
-            firstPage = getLower(new->known, new->queryDepth);
+    // a group being split incrementally may still have matching
+    //   tuples in its buckets under the old addressing
+    PageID src[psize+1];
+    for (Bits c = 0; c < ncombos; c++) {
+        Count n = splitSources(r, starCombo(new, c), new->unknown, src);
+        for (Count k = 0; k < n; k++) {
+            Count j = 0;
+            while (j < new->nbuckets && new->buckets[j] != src[k]) j++;
+            if (j == new->nbuckets) new->buckets[new->nbuckets++] = src[k];
         }
-        // count number of stars and store all star position
-        for (int i = 0; i < new->queryDepth; i++) {
-            if (strchr(vals[cv[i].att], '?') || strchr(vals[cv[i].att], '%')) {
-                new->nstars++;
-                new->starsPosition[starIdx] = i;
-                starIdx++;
-            }
+    }
+    // with a trigram index on a pattern attribute, drop buckets
+    //   which can't hold all of the pattern's trigrams
+    NgramIndex x = ngramIndex(r);
+    Field *v = (x != NULL) ? &vals[ngramAttr(x)] : NULL;
+    if (v != NULL && memchr(v->val, '%', v->len) && !memchr(v->val, '?', v->len)) {
+        Bits keys[MAXTUPLEN];
+        Count nkeys = ngramKeys(v->val, v->len, keys, MAXTUPLEN);
+        Count n = 0;
+        for (Count j = 0; j < new->nbuckets; j++) {
+            if (ngramMayMatch(x, new->buckets[j], keys, nkeys))
+                new->buckets[n++] = new->buckets[j];
         }
-	}
-
-	// set all values in SelectionRep object
-    new->curpage = getPage(dataFile(new->rel),firstPage);
-    new->curtupOffset = 0;
-    new->curTuple = pageData(new->curpage);
-
-    if (new->nstars == 0) {
-        new->curcandidatePage = 0;
-        new->totalcandidatePages = 0;
+        new->nbuckets = n;
     }
-    else {
-        new->curcandidatePage = 1;
-        new->totalcandidatePages = 1 << new->nstars;
+    new->ncands = new->nbuckets;
+    planSelection(new);
+    if (new->seqscan) {
+        new->nbuckets = npages(r) + fileNPages(ovflowFile(r));
+        advisePageFile(dataFile(r), 0, 0, PF_SEQUENTIAL);
+        advisePageFile(ovflowFile(r), 0, 0, PF_SEQUENTIAL);
     }
+    new->curbucket = 0;
+    new->prefetched = 0;
+    new->curpage = NULL;
+    new->is_ovflow = FALSE;
+    new->curtupOffset = 0;
+    prefetchBuckets(new);
 
     return new;
 }
@@ -117,114 +235,65 @@ Selection startSelection(Reln r, char *q)
 
 Tuple getNextTuple(Selection q)
 {
-    // TODO
-	// Partial algorithm:
-    // if (more tuples in current page)
-    //    get next matching tuple from current page
-
-    Tuple matchTuple = NULL;
-    while (q->curtupOffset < pageNTuples(q->curpage)) {
-        if (tupleMatch(q->rel, q->queryTuple, q->curTuple)) {
-            matchTuple = q->curTuple;
-            q->curtupOffset++;
-            q->curTuple = q->curTuple + tupLength(q->curTuple) + 1;
-            return matchTuple;
-        } else {
-            q->curtupOffset++;
-            q->curTuple = q->curTuple + tupLength(q->curTuple) + 1;
+    for (;;) {
+        // get next matching tuple from current page
+        // tuples whose stored hash differs from the query's known
+        //   bits (at any choice vector position) can't match
+        while (q->curpage != NULL && q->curtupOffset < pageNTuples(q->curpage)) {
+            Count k = q->curtupOffset++;
+            if (pageHasHashes(q->curpage)
+                && ((pageTupleHash(q->curpage, k) ^ q->known) & ~q->unknown) != 0)
+                continue;
+            Tuple t = pageTuple(q->curpage, k);
+            if (evalPred(q->pred, t)) return t;
         }
-    }
-    // else if (current page has overflow)
-    //    move to overflow page
-    //    grab first matching tuple from page
-    Offset ovid = pageOvflow(q->curpage);
-    free(q->curpage);
-    while (ovid != NO_PAGE) {
-        q->curpage = getPage(ovflowFile(q->rel), ovid);
-        q->curtupOffset = 0;
-        q->curTuple = pageData(q->curpage);
-        while (q->curtupOffset < pageNTuples(q->curpage)) {
-            if (tupleMatch(q->rel, q->queryTuple, q->curTuple)) {
-                matchTuple = q->curTuple;
-                q->curtupOffset++;
-                q->curTuple = q->curTuple + tupLength(q->curTuple) + 1;
-                return matchTuple;
-            } else {
-                q->curtupOffset++;
-                q->curTuple = q->curTuple + tupLength(q->curTuple) + 1;
-            }
+        // else if (current page has overflow)
+        //    move to overflow page
+        // (a sequential scan gets to it in the overflow file)
+        if (q->curpage != NULL && q->seqscan) {
+            releasePage(q->curpage);
+            q->curpage = NULL;
         }
-        ovid = pageOvflow(q->curpage);
-        free(q->curpage);
-    }
-
-    // else
-    //    move to "next" bucket
-    //    grab first matching tuple from data page
-    // endif
-    // if (current page has no matching tuples)
-    //    go to next page (try again)
-    // endif
-    while (q->curcandidatePage < q->totalcandidatePages) {
-        q->unknown = 0;
-        for (int i = 0; i < q->nstars; i++) {
-            if (bitIsSet(q->curcandidatePage, i)) {
-                q->unknown = setBit(q->unknown, q->starsPosition[i]);
+        if (q->curpage != NULL) {
+            Offset ovid = pageOvflow(q->curpage);
+            releasePage(q->curpage);
+            q->curpage = NULL;
+            if (ovid != NO_PAGE) {
+                q->curpage = getPage(ovflowFile(q->rel), ovid);
+                q->is_ovflow = TRUE;
+                q->curtupOffset = 0;
+                // skip its tuples if its filter rules them out
+                if (!pageMayHold(q->curpage, q->keys, q->nkeys))
+                    q->curtupOffset = pageNTuples(q->curpage);
+                startOvflowRead(q);
+                continue;
             }
         }
-
-        Bits MAVal = q->known | q->unknown;
-		MAVal = getLower(MAVal, q->queryDepth);
-        // char buf[MAXBITS+1];  //*** for debug
-        // bitsString(MAVal,buf);  //*** for debug
-        if (MAVal >= npages(q->rel)) {
-            break;
+        // else
+        //    move to "next" bucket (or page, for a sequential scan)
+        if (q->curbucket >= q->nbuckets) return NULL;
+        if (q->seqscan) {
+            PageFile f; PageID pid;
+            if (!scanPage(q, q->curbucket++, &f, &pid)) continue;
+            q->curpage = getPage(f, pid);
+            q->is_ovflow = (f == ovflowFile(q->rel));
         }
-
-        q->curpage = getPage(dataFile(q->rel),MAVal);
-        q->curtupOffset = 0;
-        q->curTuple = pageData(q->curpage);
-
-        while (q->curtupOffset < pageNTuples(q->curpage)) {
-            if (tupleMatch(q->rel, q->queryTuple, q->curTuple)) {
-                matchTuple = q->curTuple;
-                q->curtupOffset++;
-                q->curTuple = q->curTuple + tupLength(q->curTuple) + 1;
-                q->curcandidatePage++;
-                return matchTuple;
-            } else {
-                q->curtupOffset++;
-                q->curTuple = q->curTuple + tupLength(q->curTuple) + 1;
-            }
+        else {
+            q->curpage = getPage(dataFile(q->rel), q->buckets[q->curbucket++]);
+            q->is_ovflow = FALSE;
         }
-        
-        Offset ovid = pageOvflow(q->curpage);
-        free(q->curpage);
-        while (ovid != NO_PAGE) {
-            q->curpage = getPage(ovflowFile(q->rel), ovid);
-            q->curtupOffset = 0;
-            q->curTuple = pageData(q->curpage);
-            while (q->curtupOffset < pageNTuples(q->curpage)) {
-                if (tupleMatch(q->rel, q->queryTuple, q->curTuple)) {
-                    // printf("matched found: ");
-                    matchTuple = q->curTuple;
-                    q->curtupOffset++;
-                    q->curTuple = q->curTuple + tupLength(q->curTuple) + 1;
-                    q->curcandidatePage++;
-                    return matchTuple;
-                } else {
-                    q->curtupOffset++;
-                    q->curTuple = q->curTuple + tupLength(q->curTuple) + 1;
-                }
-            }
-            ovid = pageOvflow(q->curpage);
-            free(q->curpage);
+        q->curtupOffset = 0;
+        prefetchBuckets(q);
+        // a primary page's filter covers its whole chain, so the
+        //   bucket can be skipped if the filter rules it out (in a
+        //   sequential scan, any page can be skipped this way)
+        if (!pageMayHold(q->curpage, q->keys, q->nkeys)) {
+            releasePage(q->curpage);
+            q->curpage = NULL;
+            continue;
         }
-
-        q->curcandidatePage++;
+        startOvflowRead(q);
     }
-
-    return NULL;
 }
 
 // clean up a SelectionRep object and associated data
@@ -233,5 +302,28 @@ void closeSelection(Selection q)
 {
     // TODO
     if (q == NULL) return;
+    if (q->curpage != NULL) releasePage(q->curpage);
+    freePred(q->pred);
+    free(q->keys);
+    free(q->buckets);
     free(q);
 }
+
+// show how a selection will find its tuples (see planSelection())
+
+void showSelectionPlan(Selection q)
+{
+    Reln r = q->rel;
+    printf("Plan: %s\n", q->seqscan ? "sequential scan" : "probe candidate buckets");
+    printf("  probe: %d candidate buckets, %.2f pages per chain, cost %.0f\n",
+           q->ncands, 1.0 + (double)novflow(r)/npages(r), q->probeCost);
+    printf("  scan:  %d data + %d overflow pages, cost %.0f\n",
+           npages(r), novflow(r), q->scanCost);
+}
+
+// set how many candidate buckets selections read ahead
+
+void setPrefetchDepth(Count n)
+{
+    prefetchDepth = n;
+}
@@ -15,5 +15,7 @@ typedef struct SelectionRep *Selection;
 Selection startSelection(Reln, char *);
 Tuple getNextTuple(Selection);
 void closeSelection(Selection);
+void showSelectionPlan(Selection);
+void setPrefetchDepth(Count);
 
 #endif
@@ -10,7 +10,7 @@
 #include "chvec.h"
 #include "bits.h"
 #include "util.h"
-#include "regex.h"
+#include "pred.h"
 
 // return number of bytes/chars in a tuple
 
@@ -37,6 +37,31 @@ Tuple readTuple(Reln r, FILE *in)
 	return copyString(line); // needs to be free'd sometime
 }
 
+// find the fields of a tuple, without copying them
+// fields[i] is set to the i'th field, for up to max fields;
+//  if the tuple has fewer, the rest are set to empty fields
+// returns the number of fields in the tuple (up to max)
+
+int tupleFields(Tuple t, Field *fields, int max)
+{
+	char *c = t;
+	int i = 0;
+	while (i < max) {
+		char *c0 = c;
+		while (*c != ',' && *c != '\0') c++;
+		fields[i].val = c0;
+		fields[i].len = c - c0;
+		i++;
+		if (*c == '\0') break;
+		c++;
+	}
+	for (int j = i; j < max; j++) {
+		fields[j].val = c;
+		fields[j].len = 0;
+	}
+	return i;
+}
+
 // extract values into an array of strings
 
 void tupleVals(Tuple t, char **vals)
@@ -78,101 +103,69 @@ Bits tupleHash(Reln r, Tuple t)
 {
 	// char buf[MAXBITS+1];  //*** for debug
 	Count nvals = nattrs(r);
-    char **vals = malloc(nvals*sizeof(char *));
-    assert(vals != NULL);
-    tupleVals(t, vals);
+	Field vals[nvals];
+	tupleFields(t, vals, nvals);
 
-	// hash tuple
-	Bits valsHash[nvals];
-	for (int i = 0; i < nvals; i++) {
-		valsHash[i] = hash_any((unsigned char *)vals[i],strlen(vals[i]));
-	}
-	
-	// form hash result with choice vector
+	// hash each attribute, and form hash result with the
+	// (compiled) choice vector
 	Bits hashResult = 0;
-	ChVecItem *cv = chvec(r);
-	for (int i = 0; i < MAXCHVEC; i++) {
-		if (bitIsSet(valsHash[cv[i].att], cv[i].bit)) {
-			hashResult = setBit(hashResult, i);
-		}
+	ChVecPlan plan = chvecPlan(r);
+	HashFunc hash = hashFunction(hashfn(r));
+	for (int i = 0; i < nvals; i++) {
+		Bits h = hash((unsigned char *)vals[i].val, vals[i].len);
+		hashResult |= gatherBits(plan, i, h);
 	}
 	// bitsString(hashResult,buf);  //*** for debug
 	// printf("hash(%s) = %s\n", t, buf);  //*** for debug
 
-    freeVals(vals,nvals);
 	return hashResult;
 }
 
-// compare two tuples (allowing for "unknown" values)
-// TODO: actually compare values
-Bool tupleMatch(Reln r, Tuple pt, Tuple t)
+// hash n tuples at once; hs[i] == tupleHash(r, ts[i])
+// attribute values are hashed a chunk of tuples at a time (by
+//  hash_many(), for hash_any()); values of the same attribute
+//  tend to have similar lengths, so are put in neighbouring lanes
+
+#define HASHCHUNK 8  // #tuples whose values are hashed together
+
+void tupleHashes(Reln r, Tuple *ts, Count n, Bits *hs)
 {
-	Count na = nattrs(r);
-	char **querytupArray = malloc(na*sizeof(char *));
-	tupleVals(pt, querytupArray);
-	char **curtupArray = malloc(na*sizeof(char *));
-	tupleVals(t, curtupArray);
-	Bool match = TRUE;
-	// TODO: actually compare values
-	for (int i = 0; i < na; i++) {
-		// if unknown value is ?, match always equal to True
-		if (strchr(querytupArray[i], '?')) {
-			continue;
-		}
-		// if unknown value has %, check by regular expression
-		else if (strchr(querytupArray[i], '%')) {
-			size_t pattern_size = strlen(querytupArray[i]);
-			int carat = (querytupArray[i][0] != '%');
-			int dollar = (querytupArray[i][strlen(querytupArray[i])-1] != '%');
-			int percent_count = 0;
-			for (int char_idx = 0; char_idx < pattern_size; char_idx++) {
-				if (querytupArray[i][char_idx] == '%') {
-					percent_count++;
-				}
-			}
-			pattern_size += percent_count + carat + dollar;
-			regex_t regex;
-			int result;
-			char pattern[pattern_size];
-			int pattern_idx = 0;
-			if (carat) {
-				pattern[pattern_idx] = '^';
-				pattern_idx++;
-			}
-			for (int char_idx = 0; char_idx < pattern_size; char_idx++) {
-				if (querytupArray[i][char_idx] == '%') {
-					pattern[pattern_idx++] = '.';
-					pattern[pattern_idx] = '*';
-				}
-				else {
-					pattern[pattern_idx] = querytupArray[i][char_idx];
-				}
-				pattern_idx++;
-			}
-			if (dollar) {
-				pattern[pattern_idx] = '$';
-			}
-			
-			// printf("pattern is %s, cur tuple is %s\n", pattern, curtupArray[i]);
-			result = regcomp(&regex, pattern, REG_EXTENDED);
-			if (result) {
-				return -1;
+	Count nvals = nattrs(r);
+	Field vals[nvals];
+	unsigned char *keys[nvals*HASHCHUNK];
+	int lens[nvals*HASHCHUNK];
+	Bits h[nvals*HASHCHUNK];
+	ChVecPlan plan = chvecPlan(r);
+	HashFunc hash = hashFunction(hashfn(r));
+	for (Count i = 0; i < n; i += HASHCHUNK) {
+		Count m = (n-i < HASHCHUNK) ? n-i : HASHCHUNK;
+		for (Count j = 0; j < m; j++) {
+			tupleFields(ts[i+j], vals, nvals);
+			for (int a = 0; a < nvals; a++) {
+				keys[a*m+j] = (unsigned char *)vals[a].val;
+				lens[a*m+j] = vals[a].len;
 			}
-
-			result = regexec(&regex, curtupArray[i], 0, NULL, 0);
-			if (result == REG_NOMATCH) {
-				match = FALSE;
-			} 
-			regfree(&regex);
 		}
-		// if it is known value, strcmp
+		if (hashfn(r) == HASH_PG)
+			hash_many(keys, lens, nvals*m, h);
 		else {
-			if (strcmp(querytupArray[i], curtupArray[i])) {
-				match = FALSE;
-			}
+			for (int k = 0; k < nvals*m; k++) h[k] = hash(keys[k], lens[k]);
+		}
+		for (Count j = 0; j < m; j++) {
+			hs[i+j] = 0;
+			for (int a = 0; a < nvals; a++)
+				hs[i+j] |= gatherBits(plan, a, h[a*m+j]);
 		}
 	}
-	freeVals(querytupArray,na); freeVals(curtupArray,na);
+}
+
+// compare two tuples (allowing for "unknown" values)
+// for many tuples, compile pt once instead (see pred.c)
+Bool tupleMatch(Reln r, Tuple pt, Tuple t)
+{
+	Pred p = compilePred(r, pt);
+	Bool match = evalPred(p, t);
+	freePred(p);
 	return match;
 }
 
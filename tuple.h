@@ -11,12 +11,18 @@
 
 typedef char *Tuple;
 
+// a field of a tuple, in place: len chars starting at val
+// (not '\0'-terminated, except for the last field)
+typedef struct { char *val; int len; } Field;
+
 #include "reln.h"
 #include "bits.h"
 
 int tupLength(Tuple t);
 Tuple readTuple(Reln r, FILE *in);
 Bits tupleHash(Reln r, Tuple t);
+void tupleHashes(Reln r, Tuple *ts, Count n, Bits *hs);
+int tupleFields(Tuple t, Field *fields, int max);
 void tupleVals(Tuple t, char **vals);
 void freeVals(char **vals, int nattrs);
 Bool tupleMatch(Reln r, Tuple pt, Tuple t);
@@ -14,6 +14,11 @@ void fatal(char *msg)
 	exit(1);
 }
 
+void warning(char *msg)
+{
+	fprintf(stderr,"Warning: %s\n",msg);
+}
+
 char *copyString(char *str)
 {
 	char *new = malloc(strlen(str)+1);
@@ -8,6 +8,7 @@
 #define UTIL_H 1
 
 void fatal(char *);
+void warning(char *);
 char *copyString(char *);
 
 #endif